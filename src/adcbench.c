@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+
+#include "microadc.h"
+
+/*
+ * ADC conversion check and benchmark
+ *
+ * Checks the fixed point kernel against the double precision formulas
+ * tsmicroctl used before it, for every raw value of every channel, then
+ * times both over a block of frames.  The old formulas truncated through a
+ * 16 bit intermediate, so they are only expected to agree to within their
+ * own rounding, and not at all where that intermediate overflowed.
+ */
+
+#define BLOCK 4096
+
+enum { REF_S, REF_R, REF_C };
+
+struct ref {
+	int model;
+	int chan;
+	int kind;
+	int a, b;
+};
+
+/* Channel scaling as tsmicroctl --info did it */
+static const struct ref refs[] = {
+	{ 0x7970, 0, REF_S }, { 0x7970, 1, REF_S }, { 0x7970, 2, REF_S },
+	{ 0x7970, 3, REF_S }, { 0x7970, 4, REF_C, 110 }, { 0x7970, 5, REF_C, 110 },
+	{ 0x7970, 6, REF_C, 110 }, { 0x7970, 7, REF_R, 2870, 147 }, { 0x7970, 8, REF_R, 147, 107 },
+	{ 0x7970, 9, REF_R, 499, 499 }, { 0x7970, 10, REF_S }, { 0x7970, 11, REF_S },
+	{ 0x7970, 12, REF_S }, { 0x7970, 13, REF_S }, { 0x7970, 14, REF_R, 499, 499 },
+	{ 0x7990, 0, REF_R, 2870, 147 }, { 0x7990, 1, REF_R, 147, 107 }, { 0x7990, 2, REF_R, 121, 1 },
+	{ 0x7990, 3, REF_S }, { 0x7990, 4, REF_S }, { 0x7990, 5, REF_R, 100, 22 },
+	{ 0x7990, 6, REF_R, 2870, 147 }, { 0x7990, 7, REF_R, 499, 499 }, { 0x7990, 8, REF_S },
+	{ 0x7990, 9, REF_S }, { 0, 0, 0 },
+};
+
+static uint16_t sscale(uint16_t data)
+{
+	return data * (2.5 / 1023) * 1000;
+}
+
+static uint16_t rscale(uint16_t data, uint16_t r1, uint16_t r2)
+{
+	uint16_t ret = (data * (r1 + r2) / r2);
+	return sscale(ret);
+}
+
+static uint16_t cscale(uint16_t data, uint16_t shunt)
+{
+	uint32_t ret = sscale(data);
+	ret *= 1000;
+	ret /= shunt;
+
+	return (uint16_t)ret;
+}
+
+static int ref_old(const struct ref *r, uint16_t raw)
+{
+	if (r->kind == REF_R)
+		return rscale(raw, r->a, r->b);
+	if (r->kind == REF_C)
+		return cscale(raw, r->a);
+	return sscale(raw);
+}
+
+/* What the old formulas meant, without the intermediate truncation */
+static double ref_exact(const struct ref *r, uint16_t raw)
+{
+	double mv = raw * 2500.0 / 1023;
+
+	if (r->kind == REF_R)
+		return mv * (r->a + r->b) / r->b;
+	if (r->kind == REF_C)
+		return mv * 1000 / r->a;
+	return mv;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int check(void)
+{
+	uint8_t frame[MICRO_ADC_CHANS * 2];
+	uint32_t out[MICRO_ADC_CHANS];
+	int failed = 0;
+	int i, raw;
+
+	for (i = 0; refs[i].model != 0; i++) {
+		const struct ref *r = &refs[i];
+		const struct micro_adc_model *m = micro_adc_get_model(r->model);
+		double worst = 0, worst_old = 0;
+		int overflow = 0;
+
+		for (raw = 0; raw <= 1023; raw++) {
+			double exact = ref_exact(r, raw);
+			double err, err_old;
+
+			memset(frame, 0, sizeof(frame));
+			frame[r->chan * 2] = raw >> 8;
+			frame[r->chan * 2 + 1] = raw & 0xff;
+			micro_adc_convert(m, frame, 0, 1, out);
+
+			err = fabs(out[r->chan] - exact);
+			err_old = fabs(ref_old(r, raw) - exact);
+			if (err > worst)
+				worst = err;
+			if (err_old > worst_old)
+				worst_old = err_old;
+			/* Off by more than a whole ADC count */
+			if (err_old > ref_exact(r, 1) + 1)
+				overflow++;
+		}
+
+		/* Half a unit of rounding plus the error in the gain */
+		if (worst > 0.5 + 1023.0 / (1 << (MICRO_ADC_SHIFT + 1)))
+			failed = 1;
+		printf("%-6X %-14s max error %6.3f, was %9.3f%s\n", r->model, m->chans[r->chan].name, worst,
+		       worst_old, overflow ? " (overflowed)" : "");
+	}
+
+	return failed;
+}
+
+static void bench(const struct micro_adc_model *m, int rounds)
+{
+	static uint8_t frames[BLOCK][MICRO_ADC_CHANS * 2];
+	static uint32_t out[BLOCK][MICRO_ADC_CHANS];
+	const struct ref *r;
+	uint64_t start, fixed, old;
+	volatile uint32_t sink = 0;
+	int i, j;
+
+	for (i = 0; i < BLOCK; i++) {
+		for (j = 0; j < MICRO_ADC_CHANS; j++) {
+			frames[i][j * 2] = (i + j) >> 8 & 3;
+			frames[i][j * 2 + 1] = i + j;
+		}
+	}
+
+	start = now_ns();
+	for (i = 0; i < rounds; i++) {
+		micro_adc_convert(m, frames[0], sizeof(frames[0]), BLOCK, out[0]);
+		sink += out[i % BLOCK][0];
+	}
+	fixed = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < BLOCK; j++) {
+			for (r = refs; r->model != 0; r++) {
+				if (r->model == m->model)
+					out[j][r->chan] = ref_old(r, micro_adc_raw(frames[j], r->chan));
+			}
+		}
+		sink += out[i % BLOCK][0];
+	}
+	old = now_ns() - start;
+
+	printf("%-6X fixed point %8.1f Mframes/s, double %8.1f Mframes/s\n", m->model,
+	       (double)rounds * BLOCK * 1000 / fixed, (double)rounds * BLOCK * 1000 / old);
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS]\n"
+		"embeddedTS microcontroller ADC conversion check and benchmark\n"
+		"\n"
+		"  -n, --rounds <n>       Blocks of %d frames to convert (default 200)\n"
+		"  -h, --help             This message\n"
+		"\n"
+		"Exits non-zero if the fixed point conversion is off by more than\n"
+		"its rounding for any raw value.\n"
+		"\n",
+		argv[0], BLOCK);
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = 200;
+	int c;
+
+	static struct option long_options[] = { { "rounds", required_argument, 0, 'n' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "n:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 'h':
+			usage(argv);
+			return 0;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (rounds < 1) {
+		usage(argv);
+		return 1;
+	}
+
+	if (check()) {
+		fprintf(stderr, "Fixed point conversion does not match\n");
+		return 1;
+	}
+
+	printf("\n");
+	bench(micro_adc_get_model(0x7970), rounds);
+	bench(micro_adc_get_model(0x7990), rounds);
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <limits.h>
+
+#include "capfit.h"
+
+void capfit_init(struct capfit *f)
+{
+	f->n = 0;
+	f->head = 0;
+}
+
+void capfit_add(struct capfit *f, double t, int mv)
+{
+	double v = mv / 1000.0;
+
+	f->t[f->head] = t;
+	f->v2[f->head] = v * v;
+	f->head = (f->head + 1) % CAPFIT_WINDOW;
+	if (f->n < CAPFIT_WINDOW)
+		f->n++;
+}
+
+/*
+ * Returns the predicted time in ms from t until the caps fall to vmin_mv,
+ * INT_MAX if they are not discharging, or -1 if the samples do not yet
+ * cover enough time to say.
+ */
+int capfit_time_left_ms(const struct capfit *f, double t, int vmin_mv)
+{
+	double st = 0, sv = 0, stt = 0, stv = 0;
+	double slope, at, vmin2, left;
+	int oldest = f->n < CAPFIT_WINDOW ? 0 : f->head;
+	int newest = (f->head + CAPFIT_WINDOW - 1) % CAPFIT_WINDOW;
+	int i;
+
+	if (f->n < CAPFIT_MIN_SAMPLES || f->t[newest] - f->t[oldest] < CAPFIT_MIN_SPAN)
+		return -1;
+
+	/* Sums are taken relative to the first sample to keep them small */
+	for (i = 0; i < f->n; i++) {
+		double dt = f->t[i] - f->t[0];
+
+		st += dt;
+		sv += f->v2[i];
+		stt += dt * dt;
+		stv += dt * f->v2[i];
+	}
+	if (f->n * stt - st * st <= 0)
+		return -1;
+
+	slope = (f->n * stv - st * sv) / (f->n * stt - st * st);
+	if (slope >= 0)
+		return INT_MAX;
+
+	at = (sv - slope * st) / f->n + slope * (t - f->t[0]);
+	vmin2 = (vmin_mv / 1000.0) * (vmin_mv / 1000.0);
+	if (at <= vmin2)
+		return 0;
+
+	left = (vmin2 - at) / slope * 1000;
+	return left > INT_MAX ? INT_MAX : (int)left;
+}
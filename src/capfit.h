@@ -0,0 +1,28 @@
+#ifndef __CAPFIT_H_
+#define __CAPFIT_H_
+
+/*
+ * Supercap ride-through predictor
+ *
+ * Under a constant load the energy in the caps falls linearly, and energy
+ * is proportional to V^2, so V^2 against time is a straight line.  A least
+ * squares fit over the most recent samples gives the current discharge rate
+ * and from that the time left until the caps reach the cutoff voltage.
+ */
+#define CAPFIT_WINDOW 128
+#define CAPFIT_MIN_SAMPLES 8
+/* A shorter fit is mostly ADC noise */
+#define CAPFIT_MIN_SPAN 0.25
+
+struct capfit {
+	int n;
+	int head;
+	double t[CAPFIT_WINDOW]; /* Seconds since power was lost */
+	double v2[CAPFIT_WINDOW]; /* Volts squared */
+};
+
+void capfit_init(struct capfit *f);
+void capfit_add(struct capfit *f, double t, int mv);
+int capfit_time_left_ms(const struct capfit *f, double t, int vmin_mv);
+
+#endif
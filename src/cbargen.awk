@@ -0,0 +1,205 @@
+# Generates O(1) lookup tables from a crossbar-*.h pin table:
+#
+#   awk -f cbargen.awk crossbar-ts7970.h > crossbar-ts7970-hash.h
+#
+# Input and output names get a minimal-ish perfect hash.  Each slot holds the
+# index of a pin in the original table or -1, so a lookup is one hash, one
+# multiply and one strcmp.
+# Inputs that share a name are chained through <prefix>_input_next[].  Mode
+# numbers map straight to output names through <prefix>_mode_names[].
+#
+# The hash and slot calculation must match cbar_hash_find() in crossbar.c.
+
+function hash(s,    h, i)
+{
+	h = 0
+	for (i = 1; i <= length(s); i++)
+		h = (h * 31 + ord[substr(s, i, 1)]) % 65521
+	return h
+}
+
+# Hash and displace: names are split in to buckets by hash, then starting
+# with the largest bucket each one gets a multiplier that drops all of its
+# names in to free slots.  The n unique names are in uniq[], the result is
+# left in slots[], disp[], hash_size and hash_buckets.
+function perfect(n,    size, nb, i, j, b, h, a, fill, want, done, ok, taken)
+{
+	split("", h)
+	for (i = 0; i < n; i++) {
+		h[i] = hash(uniq[i])
+		for (j = 0; j < i; j++) {
+			if (h[j] == h[i]) {
+				printf "cbargen: %s and %s hash the same\n", uniq[j], uniq[i] > "/dev/stderr"
+				exit 1
+			}
+		}
+	}
+
+	for (size = 4; size < n; size *= 2)
+		;
+	for (;; size *= 2) {
+		nb = size / 4
+		split("", fill)
+		for (b = 0; b < nb; b++)
+			fill[b] = 0
+		for (i = 0; i < n; i++)
+			fill[h[i] % nb]++
+
+		split("", slots)
+		for (i = 0; i < size; i++)
+			slots[i] = -1
+		ok = 1
+		for (want = n; want > 0 && ok; want--) {
+			for (b = 0; b < nb && ok; b++) {
+				if (fill[b] != want)
+					continue
+				done = 0
+				for (a = 1; a < 65521 && !done; a++) {
+					split("", taken)
+					done = 1
+					for (i = 0; i < n && done; i++) {
+						if (h[i] % nb != b)
+							continue
+						j = (a * h[i]) % 65521 % size
+						if (slots[j] != -1 || (j in taken))
+							done = 0
+						taken[j] = i
+					}
+				}
+				if (!done) {
+					ok = 0
+					break
+				}
+				disp[b] = a - 1
+				for (j in taken)
+					slots[j] = taken[j]
+			}
+		}
+		for (b = 0; b < nb; b++) {
+			if (fill[b] == 0)
+				disp[b] = 0
+		}
+		if (ok) {
+			hash_size = size
+			hash_buckets = nb
+			return
+		}
+	}
+}
+
+function emit_table(type, name, n, vals,    i, line)
+{
+	printf "static const %s %s[%d] = {\n", type, name, n
+	line = "\t"
+	for (i = 0; i < n; i++) {
+		line = line vals[i] ","
+		if (i % 16 == 15 || i == n - 1) {
+			print line
+			line = "\t"
+		} else {
+			line = line " "
+		}
+	}
+	print "};"
+}
+
+function emit_hash(name, n, idx,    i, out)
+{
+	perfect(n)
+	emit_table("uint16_t", prefix "_" name "_disp", hash_buckets, disp)
+	for (i = 0; i < hash_size; i++)
+		out[i] = slots[i] == -1 ? -1 : idx[slots[i]]
+	emit_table("int16_t", prefix "_" name "_slots", hash_size, out)
+	printf "static const struct cbar_hash %s_%s_hash = { %d, %s_%s_disp, %d, %s_%s_slots };\n\n", prefix, name,
+		hash_buckets, prefix, name, hash_size, prefix, name
+}
+
+BEGIN {
+	nin = nout = 0
+	for (i = 1; i < 128; i++)
+		ord[sprintf("%c", i)] = i
+}
+
+/static struct cbarpin/ {
+	match($0, /[a-z0-9]+_(inputs|outputs)/)
+	split(substr($0, RSTART, RLENGTH), part, "_")
+	prefix = part[1]
+	section = part[2]
+	next
+}
+
+/\{ *[0-9]+, *"/ {
+	line = $0
+	sub(/^[ \t]*\{ */, "", line)
+	addr = line + 0
+	match(line, /"[^"]*"/)
+	name = substr(line, RSTART + 1, RLENGTH - 2)
+	if (section == "inputs") {
+		in_name[nin++] = name
+	} else {
+		out_name[nout] = name
+		out_mode[nout++] = addr
+	}
+}
+
+END {
+	guard = "_CROSSBAR_" toupper(prefix) "_HASH_H_"
+	src = FILENAME
+	sub(/.*\//, "", src)
+	printf "/* Generated from %s by cbargen.awk, do not edit */\n", src
+	printf "#ifndef %s\n#define %s\n\n", guard, guard
+	print "#include <stddef.h>\n#include <stdint.h>\n\n#include \"crossbar.h\"\n"
+
+	# Inputs, only the first of each name goes in the hash
+	n = 0
+	split("", seen)
+	for (i = 0; i < nin; i++) {
+		if (in_name[i] in seen)
+			continue
+		seen[in_name[i]] = i
+		uniq[n] = in_name[i]
+		idx[n++] = i
+	}
+	emit_hash("input", n, idx)
+
+	printf "static const int16_t %s_input_next[%d] = {\n", prefix, nin
+	for (i = 0; i < nin; i++) {
+		next_in = -1
+		for (j = i + 1; j < nin && next_in == -1; j++) {
+			if (in_name[j] == in_name[i])
+				next_in = j
+		}
+		printf "\t%d, /* %s */\n", next_in, in_name[i]
+	}
+	print "};\n"
+
+	# Outputs, keeping the first if a name or mode repeats
+	n = 0
+	split("", seen)
+	split("", idx)
+	nmodes = 0
+	for (i = 0; i < nout; i++) {
+		if (out_mode[i] >= nmodes)
+			nmodes = out_mode[i] + 1
+		if (!(out_mode[i] in mode_name))
+			mode_name[out_mode[i]] = out_name[i]
+		if (out_name[i] in seen)
+			continue
+		seen[out_name[i]] = i
+		uniq[n] = out_name[i]
+		idx[n++] = i
+	}
+	emit_hash("output", n, idx)
+
+	printf "#define %s_NMODES %d\n", toupper(prefix), nmodes
+	printf "static const char *const %s_mode_names[%s_NMODES] = {\n", prefix, toupper(prefix)
+	for (i = 0; i < nmodes; i++) {
+		if (i in mode_name)
+			printf "\t\"%s\",\n", mode_name[i]
+		else
+			print "\tNULL,"
+	}
+	print "};\n"
+
+	printf "#endif //%s\n", guard
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "crossbar.h"
+#include "cbarprof.h"
+#include "fpgaimg.h"
+
+/*
+ * Crossbar profiles
+ *
+ * A profile is a text file naming the model and the routes to set, in the
+ * same INPUT=OUTPUT form "tshwctl --get" prints:
+ *
+ *   # RS-485 on the TS-7970 header
+ *   model 0x7970
+ *   TTYMXC1_RXD=MB_RXD_485
+ *   EN_OUT_1=GPIO high
+ *
+ * A route may be followed by "in", "low" or "high" to also set the direction
+ * and output value bits of the pad.  Inputs that are not named keep their
+ * current setting.  Profiles compile to an FPGA register image whose mask
+ * only covers the bits the profile sets, so applying one only writes the
+ * registers it would change.
+ */
+
+#define CBAR_DIR_OUT 0x1
+#define CBAR_VAL_HIGH 0x2
+
+static char *trim(char *s)
+{
+	char *e;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	e = s + strlen(s);
+	while (e > s && isspace((unsigned char)e[-1]))
+		*--e = 0;
+
+	return s;
+}
+
+static int profile_route(const struct cbar_model *cbar, struct fpga_image *img, const char *where, char *line)
+{
+	char *eq = strchr(line, '=');
+	char *name, *output, *pad;
+	int i, mode, bits, bitmask;
+
+	if (eq == NULL) {
+		fprintf(stderr, "%s: expected INPUT=OUTPUT\n", where);
+		return 1;
+	}
+	*eq = 0;
+	name = trim(line);
+	output = strtok(eq + 1, " \t");
+	pad = strtok(NULL, " \t");
+	if (output == NULL || strtok(NULL, " \t") != NULL) {
+		fprintf(stderr, "%s: expected INPUT=OUTPUT [in|low|high]\n", where);
+		return 1;
+	}
+
+	i = cbar_find_input(cbar, name, strlen(name));
+	if (i < 0) {
+		fprintf(stderr, "%s: no input named %s on the TS-%X\n", where, name, cbar->model);
+		return 1;
+	}
+
+	mode = cbar_find_output(cbar, output);
+	if (mode < 0 || mode >= 1 << cbar->size) {
+		fprintf(stderr, "%s: no output named %s on the TS-%X\n", where, output, cbar->model);
+		return 1;
+	}
+
+	bits = mode << (8 - cbar->size);
+	bitmask = ~cbar->mask & 0xff;
+	if (pad && strcmp(pad, "in") == 0) {
+		bitmask |= CBAR_DIR_OUT;
+	} else if (pad && (strcmp(pad, "low") == 0 || strcmp(pad, "high") == 0)) {
+		bits |= CBAR_DIR_OUT | (pad[0] == 'h' ? CBAR_VAL_HIGH : 0);
+		bitmask |= CBAR_DIR_OUT | CBAR_VAL_HIGH;
+	} else if (pad) {
+		fprintf(stderr, "%s: expected in, low or high, not %s\n", where, pad);
+		return 1;
+	}
+
+	for (; i >= 0; i = cbar->input_next[i]) {
+		int addr = cbar->inputs[i].addr;
+
+		if (img->mask[addr]) {
+			fprintf(stderr, "%s: %s is set more than once\n", where, name);
+			return 1;
+		}
+		img->regs[addr] = bits;
+		img->mask[addr] = bitmask;
+	}
+
+	return 0;
+}
+
+/* Parses and validates a profile in to a register image.  Errors are
+ * reported with the file and line. */
+int cbar_profile_compile(const char *path, struct fpga_image *img)
+{
+	const struct cbar_model *cbar = NULL;
+	char where[256];
+	char buf[256];
+	int lineno = 0;
+	int errors = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	memset(img, 0, sizeof(*img));
+	img->base = 0;
+	img->len = FPGAIMG_REGS;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		char *line, *hash;
+
+		lineno++;
+		snprintf(where, sizeof(where), "%s:%d", path, lineno);
+		hash = strchr(buf, '#');
+		if (hash)
+			*hash = 0;
+		line = trim(buf);
+		if (*line == 0)
+			continue;
+
+		if (strncmp(line, "model", 5) == 0 && isspace((unsigned char)line[5])) {
+			if (cbar != NULL) {
+				fprintf(stderr, "%s: model given more than once\n", where);
+				errors++;
+				break;
+			}
+			img->model = strtoul(line + 5, NULL, 0);
+			cbar = cbar_get_model(img->model);
+			if (cbar == NULL) {
+				fprintf(stderr, "%s: unsupported model %s\n", where, trim(line + 5));
+				errors++;
+				break;
+			}
+			continue;
+		}
+
+		if (cbar == NULL) {
+			fprintf(stderr, "%s: the model must be given before any routes\n", where);
+			errors++;
+			break;
+		}
+
+		if (profile_route(cbar, img, where, line))
+			errors++;
+	}
+	fclose(f);
+
+	if (cbar == NULL && errors == 0) {
+		fprintf(stderr, "%s: no model given\n", path);
+		errors++;
+	}
+
+	return errors != 0;
+}
+
+/* Loads either a compiled profile or the text, compiling it */
+int cbar_profile_load(const char *path, struct fpga_image *img)
+{
+	char magic[4];
+	FILE *f;
+	int compiled;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+	compiled = fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, FPGAIMG_MAGIC, 4) == 0;
+	fclose(f);
+
+	if (compiled)
+		return fpga_image_load(path, img);
+
+	return cbar_profile_compile(path, img);
+}
@@ -0,0 +1,9 @@
+#ifndef __CBARPROF_H_
+#define __CBARPROF_H_
+
+#include "fpgaimg.h"
+
+int cbar_profile_compile(const char *path, struct fpga_image *img);
+int cbar_profile_load(const char *path, struct fpga_image *img);
+
+#endif
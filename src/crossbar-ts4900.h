@@ -2,7 +2,7 @@
 #define _CROSSBAR_TS4900_H_
 #include "fpga.h"
 
-struct cbarpin ts4900_inputs[] = {
+static struct cbarpin ts4900_inputs[] = {
 	{ 0, "CN1_63" },
 	{ 1, "CN1_67" },
 	{ 2, "CN1_87" },
@@ -28,7 +28,7 @@ struct cbarpin ts4900_inputs[] = {
 	{ 0, 0 },
 };
 
-struct cbarpin ts4900_outputs[] = {
+static struct cbarpin ts4900_outputs[] = {
 	{ 0, "UNCHANGED" },
 	{ 1, "BT_RTS" },
 	{ 2, "BT_TXD" },
@@ -2,7 +2,7 @@
 #define _CROSSBAR_TS7990_H_
 #include "fpga.h"
 
-struct cbarpin ts7990_inputs[] = {
+static struct cbarpin ts7990_inputs[] = {
 	{ 0, "TTYMXC2_RXD" },
 	{ 1, "TTYMXC4_RXD" },
 	{ 2, "TTYMXC2_CTS" },
@@ -43,7 +43,7 @@ struct cbarpin ts7990_inputs[] = {
 	{ 0, 0 },
 };
 
-struct cbarpin ts7990_outputs[] = {
+static struct cbarpin ts7990_outputs[] = {
 	{ 0, "UNCHANGED" },
 	{ 1, "BT_RTS" },
 	{ 2, "BT_RXD" },
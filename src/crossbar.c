@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "fpga.h"
+#include "crossbar.h"
+#include "crossbar-ts4900.h"
+#include "crossbar-ts7970.h"
+#include "crossbar-ts7990.h"
+#include "crossbar-ts4900-hash.h"
+#include "crossbar-ts7970-hash.h"
+#include "crossbar-ts7990-hash.h"
+
+extern char **environ;
+
+/* Unused registers between inputs are read anyway when the gap is shorter
+ * than this, it is cheaper than addressing another read on the bus. */
+#define CBAR_GAP_MAX 8
+
+static const struct cbar_model cbar_models[] = {
+	{ 0x4900, ts4900_inputs, ts4900_outputs, 5, 7, &ts4900_input_hash, ts4900_input_next, &ts4900_output_hash,
+	  ts4900_mode_names, TS4900_NMODES },
+	{ 0x7970, ts7970_inputs, ts7970_outputs, 6, 3, &ts7970_input_hash, ts7970_input_next, &ts7970_output_hash,
+	  ts7970_mode_names, TS7970_NMODES },
+	{ 0x7990, ts7990_inputs, ts7990_outputs, 6, 3, &ts7990_input_hash, ts7990_input_next, &ts7990_output_hash,
+	  ts7990_mode_names, TS7990_NMODES },
+	{ 0 },
+};
+
+const struct cbar_model *cbar_get_model(int model)
+{
+	int i;
+
+	for (i = 0; cbar_models[i].model != 0; i++) {
+		if (cbar_models[i].model == model)
+			return &cbar_models[i];
+	}
+
+	return NULL;
+}
+
+/* Returns the index of the pin called name in the hashed table, or -1.  This
+ * must match the generator in cbargen.awk. */
+static int cbar_hash_find(const struct cbar_hash *hash, const struct cbarpin *pins, const char *name, int len)
+{
+	uint32_t h = 0;
+	int i;
+
+	for (i = 0; i < len; i++)
+		h = (h * 31 + (unsigned char)name[i]) % 65521;
+	i = hash->slots[hash->disp[h % hash->nbuckets] * h % 65521 % hash->size];
+
+	if (i < 0 || strncmp(pins[i].name, name, len) != 0 || pins[i].name[len] != 0)
+		return -1;
+
+	return i;
+}
+
+/* Returns the first input with this name, see input_next[] for others.  The
+ * name does not need to be terminated. */
+int cbar_find_input(const struct cbar_model *cbar, const char *name, int len)
+{
+	return cbar_hash_find(cbar->input_hash, cbar->inputs, name, len);
+}
+
+/* Returns the mode for the named output, or -1 if it does not exist */
+int cbar_find_output(const struct cbar_model *cbar, const char *name)
+{
+	int i = cbar_hash_find(cbar->output_hash, cbar->outputs, name, strlen(name));
+
+	return i < 0 ? -1 : cbar->outputs[i].addr;
+}
+
+const char *cbar_output_name(const struct cbar_model *cbar, int mode)
+{
+	if (mode < 0 || mode >= cbar->nmodes)
+		return NULL;
+
+	return cbar->mode_names[mode];
+}
+
+/*
+ * Reads every input register with as few bursts as possible.  Inputs are
+ * grouped in to spans, only splitting where the gap between two inputs is
+ * large, and all spans go out in a single transfer.
+ */
+int cbar_snapshot_read(int i2cfd, const struct cbar_model *cbar, struct cbar_snapshot *snap)
+{
+	struct fpga_batch batch;
+	int start = -1, end = -1;
+	int i;
+
+	snap->cbar = cbar;
+	memset(snap->regs, 0, sizeof(snap->regs));
+
+	fpga_batch_init(&batch, i2cfd);
+	for (i = 0; cbar->inputs[i].name != 0; i++) {
+		int addr = cbar->inputs[i].addr;
+
+		if (start != -1 && (addr < start || addr - end > CBAR_GAP_MAX)) {
+			if (fpga_batch_peek(&batch, start, &snap->regs[start], end - start + 1))
+				return 1;
+			start = -1;
+		}
+		if (start == -1)
+			start = end = addr;
+		else if (addr > end)
+			end = addr;
+	}
+	if (start != -1) {
+		if (fpga_batch_peek(&batch, start, &snap->regs[start], end - start + 1))
+			return 1;
+	}
+
+	if (fpga_batch_commit(&batch))
+		return 1;
+
+	memcpy(snap->orig, snap->regs, sizeof(snap->regs));
+	return 0;
+}
+
+/* Writes back only the registers that changed, adjacent ones as one burst */
+int cbar_snapshot_write(int i2cfd, struct cbar_snapshot *snap)
+{
+	struct fpga_batch batch;
+	int i;
+
+	fpga_batch_init(&batch, i2cfd);
+	for (i = 0; i < CBAR_REGS; i++) {
+		if (snap->regs[i] == snap->orig[i])
+			continue;
+		if (fpga_batch_poke8(&batch, i, snap->regs[i]))
+			return 1;
+	}
+
+	if (fpga_batch_commit(&batch))
+		return 1;
+
+	memcpy(snap->orig, snap->regs, sizeof(snap->regs));
+	return 0;
+}
+
+int cbar_get_mode(const struct cbar_snapshot *snap, int input)
+{
+	return snap->regs[snap->cbar->inputs[input].addr] >> (8 - snap->cbar->size);
+}
+
+void cbar_set_mode(struct cbar_snapshot *snap, int input, int mode)
+{
+	const struct cbar_model *cbar = snap->cbar;
+	uint8_t *reg = &snap->regs[cbar->inputs[input].addr];
+
+	*reg = (mode << (8 - cbar->size)) | (*reg & cbar->mask);
+}
+
+/* Print crossbar for use in eval */
+void cbar_print_get(const struct cbar_snapshot *snap)
+{
+	const struct cbar_model *cbar = snap->cbar;
+	int i;
+
+	for (i = 0; cbar->inputs[i].name != 0; i++) {
+		const char *name = cbar_output_name(cbar, cbar_get_mode(snap, i));
+
+		if (name)
+			printf("%s=%s\n", cbar->inputs[i].name, name);
+	}
+}
+
+void cbar_print_dump(const struct cbar_snapshot *snap)
+{
+	const struct cbar_model *cbar = snap->cbar;
+	int i;
+
+	printf("%13s (DIR) (VAL) FPGA Output\n", "FPGA Pad");
+	for (i = 0; cbar->inputs[i].name != 0; i++) {
+		uint8_t value = snap->regs[cbar->inputs[i].addr];
+		const char *name = cbar_output_name(cbar, cbar_get_mode(snap, i));
+		char *dir = value & 0x1 ? "out" : "in";
+		int val;
+
+		// 4900 uses 5 bits for cbar, 7970/7990 use 6 and share
+		// the data bit for input/output
+		if (value & 0x1 || cbar->size == 6) {
+			val = value & 0x2 ? 1 : 0;
+		} else {
+			val = value & 0x4 ? 1 : 0;
+		}
+
+		if (name)
+			printf("%13s (%3s) (%3d) %s\n", cbar->inputs[i].name, dir, val, name);
+	}
+}
+
+/* Apply INPUT=OUTPUT pairs from the environment to the snapshot, walking
+ * it once.  Returns the number of invalid values found. */
+int cbar_set_from_env(struct cbar_snapshot *snap)
+{
+	const struct cbar_model *cbar = snap->cbar;
+	int errors = 0;
+	char **env;
+
+	for (env = environ; *env != NULL; env++) {
+		char *value = strchr(*env, '=');
+		int i, mode;
+
+		if (value == NULL)
+			continue;
+
+		i = cbar_find_input(cbar, *env, value - *env);
+		if (i < 0)
+			continue;
+
+		value++;
+		mode = cbar_find_output(cbar, value);
+		for (; i >= 0; i = cbar->input_next[i]) {
+			if (mode < 0) {
+				fprintf(stderr, "Invalid value \"%s\" for input %s\n", value, cbar->inputs[i].name);
+				errors++;
+				continue;
+			}
+			cbar_set_mode(snap, i, mode);
+		}
+	}
+
+	return errors;
+}
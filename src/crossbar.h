@@ -0,0 +1,58 @@
+#ifndef __CROSSBAR_H_
+#define __CROSSBAR_H_
+
+#include <stdint.h>
+
+#include "fpga.h"
+
+/* All crossbar input registers on supported models live below this */
+#define CBAR_REGS 64
+
+/* Perfect hash over pin names, generated by cbargen.awk.  slots[] holds an
+ * index in to the pin table or -1. */
+struct cbar_hash {
+	int nbuckets;
+	const uint16_t *disp;
+	int size;
+	const int16_t *slots;
+};
+
+struct cbar_model {
+	int model;
+	struct cbarpin *inputs;
+	struct cbarpin *outputs;
+	int size; /* Number of upper bits holding the output mode */
+	int mask; /* Lower bits preserved when changing the mode */
+	const struct cbar_hash *input_hash;
+	const int16_t *input_next; /* Next input with the same name, or -1 */
+	const struct cbar_hash *output_hash;
+	const char *const *mode_names; /* Output name indexed by mode */
+	int nmodes;
+};
+
+/*
+ * In-memory copy of the crossbar registers.  regs[] is indexed by register
+ * address, orig[] holds what was last read from or written to the FPGA so
+ * only the registers that were changed get written back.
+ */
+struct cbar_snapshot {
+	const struct cbar_model *cbar;
+	uint8_t regs[CBAR_REGS];
+	uint8_t orig[CBAR_REGS];
+};
+
+const struct cbar_model *cbar_get_model(int model);
+int cbar_find_input(const struct cbar_model *cbar, const char *name, int len);
+int cbar_find_output(const struct cbar_model *cbar, const char *name);
+const char *cbar_output_name(const struct cbar_model *cbar, int mode);
+
+int cbar_snapshot_read(int i2cfd, const struct cbar_model *cbar, struct cbar_snapshot *snap);
+int cbar_snapshot_write(int i2cfd, struct cbar_snapshot *snap);
+int cbar_get_mode(const struct cbar_snapshot *snap, int input);
+void cbar_set_mode(struct cbar_snapshot *snap, int input, int mode);
+
+void cbar_print_get(const struct cbar_snapshot *snap);
+void cbar_print_dump(const struct cbar_snapshot *snap);
+int cbar_set_from_env(struct cbar_snapshot *snap);
+
+#endif
@@ -1,6 +1,5 @@
 #include <stdio.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -9,43 +8,32 @@
 #include <assert.h>
 
 #include "i2c-dev.h"
+#include "fpga.h"
+#include "i2cbus.h"
 
 #define FPGA_ADDR 0x28
 
+/* Linux rejects I2C_RDWR calls with more messages than this */
+#ifndef I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_RDWR_IOCTL_MAX_MSGS 42
+#endif
+
 int fpga_init()
 {
 	static int fd = -1;
-	DIR *d;
-	struct dirent *dir;
 
 	if (fd != -1)
 		return fd;
 
-	// Depending on which baseboard the TS-4900 is used on there
-	// May be a different number of /dev/i2c-* devices.  This will
-	// search for the name 21a0000.i2c where the name is the
-	// memory address in the imx6 of the correct i2c bus.
-	d = opendir("/sys/bus/i2c/devices/");
-	if (d) {
-		while ((dir = readdir(d)) != NULL) {
-			char path[512], busname[512];
-			int namefd;
-			snprintf(path, 512, "/sys/bus/i2c/devices/%s/name", dir->d_name);
-			namefd = open(path, O_RDONLY);
-			if (namefd == -1)
-				continue;
-			if (read(namefd, busname, 512) == -1)
-				perror("busname");
-			if (strncmp(busname, "21a0000.i2c", 11) == 0) {
-				snprintf(path, 512, "/dev/%s", dir->d_name);
-				fd = open(path, O_RDWR);
-			}
-		}
-		closedir(d);
-	}
+	fd = i2cbus_connect(I2CBUS_FPGA);
+	if (fd != -1)
+		return fd;
+
+	// The memory address in the imx6 of the correct i2c bus
+	fd = i2cbus_open_adapter("21a0000.i2c");
 
 	if (fd != -1) {
-		if (ioctl(fd, I2C_SLAVE_FORCE, FPGA_ADDR) < 0) {
+		if (i2cbus_set_slave(fd, FPGA_ADDR) < 0) {
 			perror("FPGA did not ACK\n");
 			return -1;
 		}
@@ -56,7 +44,6 @@ int fpga_init()
 
 int fpeekstream8(int i2cfd, uint8_t *data, uint16_t addr, int size)
 {
-	struct i2c_rdwr_ioctl_data packets;
 	struct i2c_msg msgs[2];
 	char busaddr[2];
 
@@ -77,10 +64,7 @@ int fpeekstream8(int i2cfd, uint8_t *data, uint16_t addr, int size)
 	msgs[1].len = size;
 	msgs[1].buf = (char *)data;
 
-	packets.msgs = msgs;
-	packets.nmsgs = 2;
-
-	if (ioctl(i2cfd, I2C_RDWR, &packets) < 0) {
+	if (i2cbus_transfer(i2cfd, msgs, 2) < 0) {
 		perror("Unable to read I2C data");
 		return 1;
 	}
@@ -89,7 +73,6 @@ int fpeekstream8(int i2cfd, uint8_t *data, uint16_t addr, int size)
 
 int fpokestream8(int i2cfd, uint8_t *data, uint16_t addr, int size)
 {
-	struct i2c_rdwr_ioctl_data packets;
 	struct i2c_msg msg;
 	uint8_t outdata[4096];
 
@@ -106,10 +89,7 @@ int fpokestream8(int i2cfd, uint8_t *data, uint16_t addr, int size)
 	msg.len = 2 + size;
 	msg.buf = (char *)outdata;
 
-	packets.msgs = &msg;
-	packets.nmsgs = 1;
-
-	if (ioctl(i2cfd, I2C_RDWR, &packets) < 0) {
+	if (i2cbus_transfer(i2cfd, &msg, 1) < 0) {
 		perror("Unable to send I2C data");
 		return 1;
 	}
@@ -137,3 +117,174 @@ uint8_t fpeek8(int i2cfd, uint16_t addr)
 	}
 	return data;
 }
+
+/*
+ * Transaction batches
+ *
+ * Reads and writes are queued with fpga_batch_peek()/fpga_batch_poke() and
+ * sent with fpga_batch_commit().  Accesses to adjacent registers in the same
+ * direction are merged into a single message as they are queued, and as many
+ * messages as the kernel allows are packed into each I2C_RDWR.  Read data is
+ * only valid in the caller's buffer after the batch has been committed.
+ */
+void fpga_batch_init(struct fpga_batch *b, int i2cfd)
+{
+	b->i2cfd = i2cfd;
+	b->nsegs = 0;
+	b->nreads = 0;
+	b->used = 0;
+}
+
+/* Nonzero if the access can be merged in to the last segment.  Only the last
+ * segment can grow since its data sits at the end of buf. */
+static int fpga_batch_merges(struct fpga_batch *b, uint16_t addr, int size, int rd)
+{
+	struct fpga_batch_seg *seg;
+
+	if (b->nsegs == 0)
+		return 0;
+	seg = &b->segs[b->nsegs - 1];
+
+	return seg->rd == rd && seg->addr + seg->len == addr && seg->len + size <= 4094 &&
+	       b->used + size <= FPGA_BATCH_BUF;
+}
+
+/* Returns the segment the access was merged in to or appended as, flushing
+ * the batch first if it is out of room.  NULL on failure. */
+static struct fpga_batch_seg *fpga_batch_add(struct fpga_batch *b, uint16_t addr, int size, int rd)
+{
+	struct fpga_batch_seg *seg;
+
+	assert(size > 0 && size <= 4094);
+
+	if (fpga_batch_merges(b, addr, size, rd)) {
+		seg = &b->segs[b->nsegs - 1];
+		seg->len += size;
+		b->used += size;
+		return seg;
+	}
+
+	if (b->nsegs == FPGA_BATCH_SEGS || b->nreads == FPGA_BATCH_READS || b->used + 2 + size > FPGA_BATCH_BUF) {
+		if (fpga_batch_commit(b))
+			return NULL;
+	}
+
+	seg = &b->segs[b->nsegs++];
+	seg->addr = addr;
+	seg->len = size;
+	seg->off = b->used;
+	seg->rd = rd;
+	b->buf[b->used] = ((addr >> 8) & 0xff);
+	b->buf[b->used + 1] = (addr & 0xff);
+	b->used += 2 + size;
+
+	return seg;
+}
+
+int fpga_batch_peek(struct fpga_batch *b, uint16_t addr, uint8_t *data, int size)
+{
+	struct fpga_batch_read *rd = NULL;
+
+	/* A peek that continues both the last read segment and the last
+	 * caller buffer only lengthens the last read.  Anything else needs
+	 * another read, and if they have run out the batch is sent first. */
+	if (b->nreads && fpga_batch_merges(b, addr, size, 1)) {
+		rd = &b->reads[b->nreads - 1];
+		if (rd->dst + rd->len != data)
+			rd = NULL;
+	}
+	if (rd == NULL && b->nreads == FPGA_BATCH_READS && fpga_batch_commit(b))
+		return 1;
+
+	if (fpga_batch_add(b, addr, size, 1) == NULL)
+		return 1;
+
+	if (rd) {
+		rd->len += size;
+		return 0;
+	}
+
+	assert(b->nreads < FPGA_BATCH_READS);
+	rd = &b->reads[b->nreads++];
+	rd->dst = data;
+	rd->off = b->used - size;
+	rd->len = size;
+
+	return 0;
+}
+
+int fpga_batch_poke(struct fpga_batch *b, uint16_t addr, const uint8_t *data, int size)
+{
+	if (fpga_batch_add(b, addr, size, 0) == NULL)
+		return 1;
+
+	memcpy(&b->buf[b->used - size], data, size);
+
+	return 0;
+}
+
+int fpga_batch_poke8(struct fpga_batch *b, uint16_t addr, uint8_t value)
+{
+	return fpga_batch_poke(b, addr, &value, 1);
+}
+
+static int fpga_batch_xfer(int i2cfd, struct i2c_msg *msgs, int nmsgs)
+{
+	if (i2cbus_transfer(i2cfd, msgs, nmsgs) < 0) {
+		perror("Unable to transfer I2C data");
+		return 1;
+	}
+	return 0;
+}
+
+int fpga_batch_commit(struct fpga_batch *b)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	int nmsgs = 0;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < b->nsegs; i++) {
+		struct fpga_batch_seg *seg = &b->segs[i];
+		int need = seg->rd ? 2 : 1;
+
+		if (nmsgs + need > I2C_RDWR_IOCTL_MAX_MSGS) {
+			ret = fpga_batch_xfer(b->i2cfd, msgs, nmsgs);
+			if (ret)
+				goto out;
+			nmsgs = 0;
+		}
+
+		if (seg->rd) {
+			msgs[nmsgs].addr = FPGA_ADDR;
+			msgs[nmsgs].flags = 0;
+			msgs[nmsgs].len = 2;
+			msgs[nmsgs].buf = (char *)&b->buf[seg->off];
+			nmsgs++;
+
+			msgs[nmsgs].addr = FPGA_ADDR;
+			msgs[nmsgs].flags = I2C_M_RD;
+			msgs[nmsgs].len = seg->len;
+			msgs[nmsgs].buf = (char *)&b->buf[seg->off + 2];
+			nmsgs++;
+		} else {
+			msgs[nmsgs].addr = FPGA_ADDR;
+			msgs[nmsgs].flags = 0;
+			msgs[nmsgs].len = 2 + seg->len;
+			msgs[nmsgs].buf = (char *)&b->buf[seg->off];
+			nmsgs++;
+		}
+	}
+
+	if (nmsgs)
+		ret = fpga_batch_xfer(b->i2cfd, msgs, nmsgs);
+
+	if (ret == 0) {
+		for (i = 0; i < b->nreads; i++)
+			memcpy(b->reads[i].dst, &b->buf[b->reads[i].off], b->reads[i].len);
+	}
+
+out:
+	fpga_batch_init(b, b->i2cfd);
+	return ret;
+}
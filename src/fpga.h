@@ -1,13 +1,53 @@
 #ifndef __FPGA_H_
 #define __FPGA_H_
 
+#include <stdint.h>
+
 struct cbarpin {
 	int addr;
 	char *name;
 };
 
+/* Limits for a single batch.  Segments are runs of contiguous registers
+ * accessed in the same direction, and each one becomes one (write) or two
+ * (address write + read) i2c_msgs when the batch is committed. */
+#define FPGA_BATCH_SEGS 64
+#define FPGA_BATCH_READS 64
+#define FPGA_BATCH_BUF 4096
+
+struct fpga_batch_seg {
+	uint16_t addr;
+	uint16_t len;
+	uint16_t off; /* Offset of the 2 byte bus address in buf, data follows */
+	uint8_t rd;
+};
+
+struct fpga_batch_read {
+	uint8_t *dst;
+	uint16_t off;
+	uint16_t len;
+};
+
+struct fpga_batch {
+	int i2cfd;
+	int nsegs;
+	int nreads;
+	int used;
+	struct fpga_batch_seg segs[FPGA_BATCH_SEGS];
+	struct fpga_batch_read reads[FPGA_BATCH_READS];
+	uint8_t buf[FPGA_BATCH_BUF];
+};
+
 int fpga_init(void);
 void fpoke8(int i2cfd, uint16_t addr, uint8_t value);
 uint8_t fpeek8(int i2cfd, uint16_t addr);
+int fpeekstream8(int i2cfd, uint8_t *data, uint16_t addr, int size);
+int fpokestream8(int i2cfd, uint8_t *data, uint16_t addr, int size);
+
+void fpga_batch_init(struct fpga_batch *b, int i2cfd);
+int fpga_batch_peek(struct fpga_batch *b, uint16_t addr, uint8_t *data, int size);
+int fpga_batch_poke(struct fpga_batch *b, uint16_t addr, const uint8_t *data, int size);
+int fpga_batch_poke8(struct fpga_batch *b, uint16_t addr, uint8_t value);
+int fpga_batch_commit(struct fpga_batch *b);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fpga.h"
+#include "i2cbus.h"
+#include "crossbar.h"
+#include "lathist.h"
+#include "model.h"
+
+/*
+ * FPGA access benchmark
+ *
+ * Runs each access pattern a number of times and reports throughput and
+ * latency percentiles.  Every write puts back the value that was read from
+ * the same register, so this is safe to run on a live board.  Run with
+ * TS_I2C_BACKEND=sim to measure against the simulated bus.
+ *
+ * Putting a value back is only harmless for registers without side effects,
+ * so on hardware the stream patterns stay within the first SAFE_BURST
+ * registers from the first crossbar input.  Longer bursts need the sim.
+ */
+
+/* Register bytes moved per op, for the patterns whose size varies */
+#define SIZE_BURST -1
+#define SIZE_INPUTS -2
+
+#define SAFE_BURST 64
+
+struct bench {
+	const char *name;
+	int (*run)(int i2cfd);
+	int size;
+};
+
+static const struct cbar_model *cbar;
+static uint16_t reg_addr;
+static uint16_t burst_addr;
+static int burst_len = 16;
+static uint8_t burst_buf[4094];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int run_peek8(int i2cfd)
+{
+	return fpeekstream8(i2cfd, burst_buf, reg_addr, 1);
+}
+
+static int run_poke8(int i2cfd)
+{
+	return fpokestream8(i2cfd, burst_buf, reg_addr, 1);
+}
+
+static int run_peekstream(int i2cfd)
+{
+	return fpeekstream8(i2cfd, burst_buf, burst_addr, burst_len);
+}
+
+static int run_pokestream(int i2cfd)
+{
+	return fpokestream8(i2cfd, burst_buf, burst_addr, burst_len);
+}
+
+/* Every crossbar input one register at a time, as tshwctl used to */
+static int run_scattered(int i2cfd)
+{
+	int i;
+
+	for (i = 0; cbar->inputs[i].name != 0; i++) {
+		if (fpeekstream8(i2cfd, &burst_buf[i], cbar->inputs[i].addr, 1))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* The same registers queued in one batch */
+static int run_scattered_batch(int i2cfd)
+{
+	struct fpga_batch batch;
+	int i;
+
+	fpga_batch_init(&batch, i2cfd);
+	for (i = 0; cbar->inputs[i].name != 0; i++) {
+		if (fpga_batch_peek(&batch, cbar->inputs[i].addr, &burst_buf[i], 1))
+			return 1;
+	}
+
+	return fpga_batch_commit(&batch);
+}
+
+static int run_rmw(int i2cfd)
+{
+	uint8_t val;
+
+	if (fpeekstream8(i2cfd, &val, reg_addr, 1))
+		return 1;
+
+	return fpokestream8(i2cfd, &val, reg_addr, 1);
+}
+
+static int run_cbar_get(int i2cfd)
+{
+	struct cbar_snapshot snap;
+
+	if (cbar_snapshot_read(i2cfd, cbar, &snap))
+		return 1;
+	cbar_print_get(&snap);
+
+	return 0;
+}
+
+static int run_cbar_dump(int i2cfd)
+{
+	struct cbar_snapshot snap;
+
+	if (cbar_snapshot_read(i2cfd, cbar, &snap))
+		return 1;
+	cbar_print_dump(&snap);
+
+	return 0;
+}
+
+/* Route every input to where it already goes, the same work as tshwctl
+ * --set with every input named in the environment */
+static int run_cbar_set(int i2cfd)
+{
+	struct cbar_snapshot snap;
+	int i;
+
+	if (cbar_snapshot_read(i2cfd, cbar, &snap))
+		return 1;
+	for (i = 0; cbar->inputs[i].name != 0; i++)
+		cbar_set_mode(&snap, i, cbar_get_mode(&snap, i));
+
+	return cbar_snapshot_write(i2cfd, &snap);
+}
+
+static const struct bench benches[] = {
+	{ "peek8", run_peek8, 1 },
+	{ "poke8", run_poke8, 1 },
+	{ "peekstream8", run_peekstream, SIZE_BURST },
+	{ "pokestream8", run_pokestream, SIZE_BURST },
+	{ "scattered", run_scattered, SIZE_INPUTS },
+	{ "scattered-batch", run_scattered_batch, SIZE_INPUTS },
+	{ "rmw", run_rmw, 2 },
+	{ "cbar-get", run_cbar_get, SIZE_INPUTS },
+	{ "cbar-dump", run_cbar_dump, SIZE_INPUTS },
+	{ "cbar-set", run_cbar_set, SIZE_INPUTS },
+	{ 0, 0, 0 },
+};
+
+static int ninputs;
+
+static int setup(int i2cfd)
+{
+	struct cbar_snapshot snap;
+
+	if (cbar_snapshot_read(i2cfd, cbar, &snap))
+		return 1;
+
+	/* Writes go to the first crossbar input and put back what is there */
+	reg_addr = cbar->inputs[0].addr;
+	burst_addr = reg_addr;
+	if (fpeekstream8(i2cfd, burst_buf, burst_addr, burst_len))
+		return 1;
+
+	for (ninputs = 0; cbar->inputs[ninputs].name != 0; ninputs++)
+		;
+
+	return 0;
+}
+
+static int bench_run(int i2cfd, const struct bench *b, int ops)
+{
+	int bytes = b->size == SIZE_BURST ? burst_len : b->size == SIZE_INPUTS ? ninputs : b->size;
+	struct lathist hist;
+	uint64_t start, total;
+	int stdout_fd;
+	int devnull;
+	int ret = 0;
+	int i;
+
+	/* The crossbar paths print like tshwctl does, throw that away */
+	fflush(stdout);
+	stdout_fd = dup(STDOUT_FILENO);
+	devnull = open("/dev/null", O_WRONLY);
+	dup2(devnull, STDOUT_FILENO);
+	close(devnull);
+
+	lathist_init(&hist);
+	total = now_ns();
+	for (i = 0; i < ops && ret == 0; i++) {
+		start = now_ns();
+		ret = b->run(i2cfd);
+		lathist_add(&hist, now_ns() - start);
+	}
+	total = now_ns() - total;
+
+	fflush(stdout);
+	dup2(stdout_fd, STDOUT_FILENO);
+	close(stdout_fd);
+
+	if (ret) {
+		fprintf(stderr, "%s failed\n", b->name);
+		return 1;
+	}
+
+	printf("%-16s %10.0f %12.0f %9.1f %9.1f %9.1f %9.1f\n", b->name, hist.count * 1e9 / total,
+	       (double)hist.count * bytes * 1e9 / total, lathist_percentile(&hist, 50) / 1000.0,
+	       lathist_percentile(&hist, 99) / 1000.0, lathist_percentile(&hist, 99.9) / 1000.0, hist.max / 1000.0);
+
+	return 0;
+}
+
+static void usage(char **argv)
+{
+	int i;
+
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] [pattern ...]\n"
+		"embeddedTS FPGA access benchmark\n"
+		"\n"
+		"  -n, --ops <count>      Operations per pattern (default 1000)\n"
+		"  -b, --burst <bytes>    Length of the stream patterns (default 16, at\n"
+		"                           most %d on hardware)\n"
+		"  -h, --help             This message\n"
+		"\n"
+		"Patterns:",
+		argv[0], SAFE_BURST);
+	for (i = 0; benches[i].name != 0; i++)
+		fprintf(stderr, " %s", benches[i].name);
+	fprintf(stderr, "\n\nSet TS_I2C_BACKEND=sim to run without hardware.\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	int ops = 1000;
+	int i2cfd;
+	int ret = 0;
+	int c, i;
+
+	static struct option long_options[] = { { "ops", required_argument, 0, 'n' },
+						{ "burst", required_argument, 0, 'b' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "n:b:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			ops = atoi(optarg);
+			break;
+		case 'b':
+			burst_len = atoi(optarg);
+			break;
+		case 'h':
+			usage(argv);
+			return 0;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (ops < 1 || burst_len < 1 || burst_len > (int)sizeof(burst_buf)) {
+		usage(argv);
+		return 1;
+	}
+
+	if (burst_len > SAFE_BURST && !i2cbus_simulated()) {
+		fprintf(stderr, "Bursts over %d bytes would write back registers with side effects, use the sim\n",
+			SAFE_BURST);
+		return 1;
+	}
+
+	i2cfd = fpga_init();
+	if (i2cfd == -1) {
+		perror("Can't open FPGA I2C bus");
+		return 1;
+	}
+
+	cbar = cbar_get_model(get_model());
+	if (cbar == NULL) {
+		fprintf(stderr, "Unsupported model\n");
+		return 1;
+	}
+
+	if (setup(i2cfd))
+		return 1;
+
+	printf("%-16s %10s %12s %9s %9s %9s %9s\n", "pattern", "ops/s", "bytes/s", "p50 us", "p99 us", "p999 us",
+	       "max us");
+	for (i = 0; benches[i].name != 0; i++) {
+		int j;
+
+		if (optind < argc) {
+			for (j = optind; j < argc; j++) {
+				if (strcmp(argv[j], benches[i].name) == 0)
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+		ret |= bench_run(i2cfd, &benches[i], ops);
+	}
+
+	return ret;
+}
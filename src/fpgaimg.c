@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "fpga.h"
+#include "crossbar.h"
+#include "fpgaimg.h"
+
+/* ttymxc1 and ttymxc3 auto TXEN counters */
+#define AUTOTXEN_REG 32
+#define AUTOTXEN_LEN 12
+
+/* Unchanged registers between two changes are rewritten with their current
+ * value when the gap is this short, rather than starting another write. */
+#define FPGAIMG_GAP_MAX 3
+
+#define FPGAIMG_HDR 12
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+/* Reads the whole register space in one burst.  The crossbar inputs and the
+ * auto TXEN counters are the registers a restore puts back. */
+int fpga_image_capture(int i2cfd, const struct cbar_model *cbar, struct fpga_image *img)
+{
+	int i;
+
+	memset(img, 0, sizeof(*img));
+	img->model = cbar->model;
+	img->base = 0;
+	img->len = FPGAIMG_REGS;
+
+	if (fpeekstream8(i2cfd, img->regs, img->base, img->len))
+		return 1;
+
+	for (i = 0; cbar->inputs[i].name != 0; i++)
+		img->mask[cbar->inputs[i].addr] = 0xff;
+	memset(&img->mask[AUTOTXEN_REG], 0xff, AUTOTXEN_LEN);
+
+	return 0;
+}
+
+int fpga_image_save(const char *path, const struct fpga_image *img)
+{
+	uint8_t hdr[FPGAIMG_HDR];
+	FILE *f;
+
+	memcpy(hdr, FPGAIMG_MAGIC, 4);
+	put16(&hdr[4], FPGAIMG_VERSION);
+	put16(&hdr[6], img->model);
+	put16(&hdr[8], img->base);
+	put16(&hdr[10], img->len);
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	if (fwrite(hdr, sizeof(hdr), 1, f) != 1 || fwrite(img->regs, img->len, 1, f) != 1 ||
+	    fwrite(img->mask, img->len, 1, f) != 1) {
+		perror(path);
+		fclose(f);
+		return 1;
+	}
+
+	if (fclose(f)) {
+		perror(path);
+		return 1;
+	}
+
+	return 0;
+}
+
+int fpga_image_load(const char *path, struct fpga_image *img)
+{
+	uint8_t hdr[FPGAIMG_HDR];
+	int version;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	memset(img, 0, sizeof(*img));
+	if (fread(hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr, FPGAIMG_MAGIC, 4) != 0) {
+		fprintf(stderr, "%s: Not an FPGA register image\n", path);
+		goto err;
+	}
+
+	version = get16(&hdr[4]);
+	if (version != FPGAIMG_VERSION) {
+		fprintf(stderr, "%s: Unsupported image version %d\n", path, version);
+		goto err;
+	}
+
+	img->model = get16(&hdr[6]);
+	img->base = get16(&hdr[8]);
+	img->len = get16(&hdr[10]);
+	if (img->len == 0 || img->base + img->len > FPGAIMG_REGS) {
+		fprintf(stderr, "%s: Image covers registers out of range\n", path);
+		goto err;
+	}
+
+	if (fread(img->regs, img->len, 1, f) != 1 || fread(img->mask, img->len, 1, f) != 1) {
+		fprintf(stderr, "%s: Image is truncated\n", path);
+		goto err;
+	}
+
+	fclose(f);
+	return 0;
+
+err:
+	fclose(f);
+	return 1;
+}
+
+static int restore_span(struct fpga_batch *batch, const struct fpga_image *img, uint8_t *want, int *start, int end)
+{
+	int ret = 0;
+
+	if (*start != -1)
+		ret = fpga_batch_poke(batch, img->base + *start, &want[*start], end - *start + 1);
+	*start = -1;
+
+	return ret;
+}
+
+/*
+ * Compares the masked bits of the image against the live registers and
+ * writes only the registers that differ.  Changes close together are
+ * coalesced in to one burst and every burst goes out in a single transfer.
+ * Returns the number of registers that were changed, or -1 on failure.
+ */
+int fpga_image_restore(int i2cfd, const struct fpga_image *img)
+{
+	uint8_t live[FPGAIMG_REGS], want[FPGAIMG_REGS];
+	struct fpga_batch batch;
+	int start = -1, end = -1;
+	int changed = 0;
+	int i;
+
+	if (fpeekstream8(i2cfd, live, img->base, img->len))
+		return -1;
+
+	for (i = 0; i < img->len; i++)
+		want[i] = (live[i] & ~img->mask[i]) | (img->regs[i] & img->mask[i]);
+
+	fpga_batch_init(&batch, i2cfd);
+	for (i = 0; i < img->len; i++) {
+		/* Gaps are only bridged over registers the image may write */
+		if (!img->mask[i] || (want[i] == live[i] && i - end > FPGAIMG_GAP_MAX)) {
+			if (restore_span(&batch, img, want, &start, end))
+				return -1;
+			continue;
+		}
+		if (want[i] == live[i])
+			continue;
+		if (start == -1)
+			start = i;
+		end = i;
+		changed++;
+	}
+	if (restore_span(&batch, img, want, &start, end) || fpga_batch_commit(&batch))
+		return -1;
+
+	return changed;
+}
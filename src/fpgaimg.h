@@ -0,0 +1,34 @@
+#ifndef __FPGAIMG_H_
+#define __FPGAIMG_H_
+
+#include <stdint.h>
+
+#include "crossbar.h"
+
+/*
+ * Image files start with a 12 byte header, all fields little endian:
+ *
+ *   "TSFI" | u16 version | u16 model | u16 base | u16 len
+ *
+ * followed by len register values and len mask bytes.  A restore only
+ * writes the bits set in each register's mask, registers with a zero mask
+ * are informational.
+ */
+#define FPGAIMG_MAGIC "TSFI"
+#define FPGAIMG_VERSION 1
+#define FPGAIMG_REGS CBAR_REGS
+
+struct fpga_image {
+	int model;
+	uint16_t base;
+	uint16_t len;
+	uint8_t regs[FPGAIMG_REGS];
+	uint8_t mask[FPGAIMG_REGS];
+};
+
+int fpga_image_capture(int i2cfd, const struct cbar_model *cbar, struct fpga_image *img);
+int fpga_image_save(const char *path, const struct fpga_image *img);
+int fpga_image_load(const char *path, struct fpga_image *img);
+int fpga_image_restore(int i2cfd, const struct fpga_image *img);
+
+#endif
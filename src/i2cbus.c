@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2cbus.h"
+#include "i2csim.h"
+#include "tshwctld.h"
+
+/*
+ * All I2C_RDWR transfers in the utilities go through i2cbus_transfer(), which
+ * hands them to the backend the fd was opened with:
+ *
+ *   dev      - a /dev/i2c-* device used directly, the default
+ *   tshwctld - a connection to the daemon, which runs the transfer for us
+ *   sim      - the simulated devices in i2csim.c, no hardware needed
+ *
+ * The TS_I2C_BACKEND environment variable can be set to "dev" to never use
+ * the daemon, or to "sim" to use the simulator for every bus.
+ */
+
+struct i2cbus_backend {
+	const char *name;
+	int (*transfer)(int fd, struct i2c_msg *msgs, int nmsgs);
+};
+
+#define I2CBUS_MAX_FDS 8
+
+static struct {
+	int fd;
+	const struct i2cbus_backend *backend;
+} bus_fds[I2CBUS_MAX_FDS];
+static int nbus_fds;
+static int daemon_model;
+static int direct_only;
+
+static int dev_transfer(int fd, struct i2c_msg *msgs, int nmsgs);
+static int tshwctld_transfer(int fd, struct i2c_msg *msgs, int nmsgs);
+
+static const struct i2cbus_backend dev_backend = { "dev", dev_transfer };
+static const struct i2cbus_backend tshwctld_backend = { "tshwctld", tshwctld_transfer };
+static const struct i2cbus_backend sim_backend = { "sim", i2csim_transfer };
+
+static const char *backend_env(void)
+{
+	const char *env = getenv("TS_I2C_BACKEND");
+
+	return env ? env : "";
+}
+
+static int use_sim(void)
+{
+	return strcmp(backend_env(), "sim") == 0;
+}
+
+int i2cbus_simulated(void)
+{
+	return use_sim();
+}
+
+/* Never use the daemon, the daemon itself sets this */
+void i2cbus_set_direct(int direct)
+{
+	direct_only = direct;
+}
+
+/* Model reported by tshwctld or simulated, 0 if neither is in use */
+int i2cbus_model(void)
+{
+	if (use_sim())
+		return i2csim_model();
+
+	return daemon_model;
+}
+
+static const struct i2cbus_backend *i2cbus_backend(int fd)
+{
+	int i;
+
+	for (i = 0; i < nbus_fds; i++) {
+		if (bus_fds[i].fd == fd)
+			return bus_fds[i].backend;
+	}
+
+	return &dev_backend;
+}
+
+static int i2cbus_register(int fd, const struct i2cbus_backend *backend)
+{
+	if (nbus_fds == I2CBUS_MAX_FDS) {
+		close(fd);
+		errno = EMFILE;
+		return -1;
+	}
+
+	bus_fds[nbus_fds].fd = fd;
+	bus_fds[nbus_fds].backend = backend;
+	nbus_fds++;
+
+	return fd;
+}
+
+static int sim_open(void)
+{
+	int fd;
+
+	/* The fd only identifies the bus, nothing is ever read from it */
+	fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	return i2cbus_register(fd, &sim_backend);
+}
+
+static int read_file(const char *path, char *buf, int len)
+{
+	int fd;
+	int ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret < 0)
+		return -1;
+	buf[ret] = '\0';
+
+	return ret;
+}
+
+static int boot_id(char *id, int len)
+{
+	if (read_file("/proc/sys/kernel/random/boot_id", id, len) < 1)
+		return -1;
+	id[strcspn(id, "\n")] = '\0';
+
+	return 0;
+}
+
+/*
+ * Boot-scoped caches
+ *
+ * Each line of the file is "<boot_id> <key> <value>", and only lines from
+ * the current boot are used, so whatever was found before a reboot is
+ * forgotten without anything having to clean up.  The files live in /run,
+ * which is tmpfs so this never touches flash.
+ */
+
+/* Returns the value cached for key in this boot, or -1 */
+int i2cbus_cache_get(const char *path, const char *key)
+{
+	char buf[1024];
+	char bootid[64];
+	char *line, *save;
+
+	if (boot_id(bootid, sizeof(bootid)) < 0)
+		return -1;
+	if (read_file(path, buf, sizeof(buf)) < 0)
+		return -1;
+
+	for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		char id[64], k[64];
+		int val;
+
+		if (sscanf(line, "%63s %63s %d", id, k, &val) != 3)
+			continue;
+		if (strcmp(id, bootid) == 0 && strcmp(k, key) == 0)
+			return val;
+	}
+
+	return -1;
+}
+
+/* Replaces any value cached for key, keeping the other keys from this boot.
+ * The file is rewritten and renamed in to place so readers never see it
+ * half written. */
+void i2cbus_cache_put(const char *path, const char *key, int value)
+{
+	char buf[1024];
+	char bootid[64];
+	char tmp[256];
+	char *line, *save;
+	FILE *f;
+
+	if (boot_id(bootid, sizeof(bootid)) < 0)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	f = fopen(tmp, "w");
+	if (f == NULL)
+		return;
+
+	if (read_file(path, buf, sizeof(buf)) >= 0) {
+		for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+			char id[64], k[64];
+			int val;
+
+			if (sscanf(line, "%63s %63s %d", id, k, &val) != 3)
+				continue;
+			if (strcmp(id, bootid) == 0 && strcmp(k, key) != 0)
+				fprintf(f, "%s %s %d\n", id, k, val);
+		}
+	}
+	fprintf(f, "%s %s %d\n", bootid, key, value);
+
+	if (fclose(f) != 0 || rename(tmp, path) != 0)
+		unlink(tmp);
+}
+
+/* The platform device for the controller has the adapter as a child, so
+ * there is no need to look at every device on every bus. */
+static int platform_lookup(const char *name)
+{
+	char path[256];
+	struct dirent *dir;
+	DIR *d;
+	int bus = -1;
+
+	snprintf(path, sizeof(path), "/sys/bus/platform/devices/%s", name);
+	d = opendir(path);
+	if (d == NULL)
+		return -1;
+
+	while ((dir = readdir(d)) != NULL) {
+		if (sscanf(dir->d_name, "i2c-%d", &bus) == 1)
+			break;
+		bus = -1;
+	}
+	closedir(d);
+
+	return bus;
+}
+
+static int scan_lookup(const char *name)
+{
+	struct dirent *dir;
+	DIR *d;
+	int bus = -1;
+
+	d = opendir("/sys/bus/i2c/devices/");
+	if (d == NULL) {
+		perror("Unable to open i2c sys directory");
+		return -1;
+	}
+
+	while ((dir = readdir(d)) != NULL) {
+		char path[512], busname[512];
+		int n;
+
+		/* Client devices are named <bus>-<addr>, only adapters matter */
+		if (sscanf(dir->d_name, "i2c-%d", &n) != 1)
+			continue;
+		snprintf(path, sizeof(path), "/sys/bus/i2c/devices/%s/name", dir->d_name);
+		if (read_file(path, busname, sizeof(busname)) < 0)
+			continue;
+		if (strncmp(busname, name, strlen(name)) == 0) {
+			bus = n;
+			break;
+		}
+	}
+	closedir(d);
+
+	return bus;
+}
+
+/*
+ * Returns the number of the I2C adapter with the given name, such as
+ * 21a0000.i2c, or -1 if it does not exist.  Depending on which baseboard is
+ * used there may be a different number of /dev/i2c-* devices, so the number
+ * can't be hardcoded.
+ */
+int i2cbus_find_adapter(const char *name, int flags)
+{
+	int cache = !(flags & I2CBUS_FIND_NOCACHE);
+	int bus = -1;
+
+	if (cache)
+		bus = i2cbus_cache_get(I2CBUS_CACHE, name);
+	if (bus != -1)
+		return bus;
+
+	if (!(flags & I2CBUS_FIND_SCAN))
+		bus = platform_lookup(name);
+	if (bus == -1)
+		bus = scan_lookup(name);
+
+	if (bus != -1 && cache)
+		i2cbus_cache_put(I2CBUS_CACHE, name, bus);
+
+	return bus;
+}
+
+/* Opens /dev/i2c-* for the named adapter, returns the fd or -1 */
+int i2cbus_open_adapter(const char *name)
+{
+	char path[32];
+	int bus;
+	int fd;
+
+	if (use_sim())
+		return sim_open();
+
+	bus = i2cbus_find_adapter(name, 0);
+	if (bus == -1)
+		return -1;
+
+	snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0 && errno == ENOENT) {
+		/* Stale cache entry, find it again the slow way */
+		bus = i2cbus_find_adapter(name, I2CBUS_FIND_NOCACHE);
+		if (bus == -1)
+			return -1;
+		snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+		fd = open(path, O_RDWR | O_CLOEXEC);
+	}
+
+	return fd;
+}
+
+/* Sends one request packet and waits for the response. Returns the response
+ * length, or -1 with errno set. */
+static int tshwctld_call(int fd, void *req, int reqlen, void *rsp, int rsplen)
+{
+	ssize_t ret;
+
+	if (send(fd, req, reqlen, MSG_NOSIGNAL) != reqlen)
+		return -1;
+
+	do {
+		ret = recv(fd, rsp, rsplen, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < (ssize_t)sizeof(struct tshwctld_rsp)) {
+		if (ret >= 0)
+			errno = EPROTO;
+		return -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Returns a connection to tshwctld bound to the given bus, or -1 if the
+ * daemon is not running and the caller should open the bus itself.
+ */
+int i2cbus_connect(int bus)
+{
+	struct sockaddr_un sun;
+	struct tshwctld_req req;
+	struct tshwctld_rsp rsp;
+	int fd;
+
+	if (direct_only || *backend_env() != '\0' || nbus_fds == I2CBUS_MAX_FDS)
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, TSHWCTLD_SOCK, sizeof(sun.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		goto fail;
+
+	memset(&req, 0, sizeof(req));
+	req.op = TSHWCTLD_OP_OPEN;
+	req.bus = bus;
+	if (tshwctld_call(fd, &req, sizeof(req), &rsp, sizeof(rsp)) < 0 || rsp.ret < 0)
+		goto fail;
+
+	daemon_model = rsp.model;
+	return i2cbus_register(fd, &tshwctld_backend);
+
+fail:
+	close(fd);
+	return -1;
+}
+
+static int tshwctld_transfer(int fd, struct i2c_msg *msgs, int nmsgs)
+{
+	static uint8_t reqbuf[sizeof(struct tshwctld_req) + TSHWCTLD_MAX_DATA];
+	static uint8_t rspbuf[sizeof(struct tshwctld_rsp) + TSHWCTLD_MAX_DATA];
+	struct tshwctld_req *req = (struct tshwctld_req *)reqbuf;
+	struct tshwctld_rsp *rsp = (struct tshwctld_rsp *)rspbuf;
+	int wlen = 0, rlen = 0;
+	int ret;
+	int i;
+
+	if (nmsgs > TSHWCTLD_MAX_MSGS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	req->op = TSHWCTLD_OP_XFER;
+	req->bus = 0;
+	req->nmsgs = nmsgs;
+	for (i = 0; i < nmsgs; i++) {
+		req->msgs[i].addr = msgs[i].addr;
+		req->msgs[i].flags = msgs[i].flags;
+		req->msgs[i].len = msgs[i].len;
+		if (msgs[i].flags & I2C_M_RD) {
+			rlen += msgs[i].len;
+		} else {
+			if (wlen + msgs[i].len > TSHWCTLD_MAX_DATA)
+				break;
+			memcpy(&reqbuf[sizeof(*req) + wlen], msgs[i].buf, msgs[i].len);
+			wlen += msgs[i].len;
+		}
+	}
+	if (i != nmsgs || rlen > TSHWCTLD_MAX_DATA) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	ret = tshwctld_call(fd, req, sizeof(*req) + wlen, rsp, sizeof(*rsp) + rlen);
+	if (ret < 0)
+		return -1;
+	if (rsp->ret < 0) {
+		errno = rsp->err;
+		return -1;
+	}
+	if (ret != (int)sizeof(*rsp) + rlen) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	rlen = 0;
+	for (i = 0; i < nmsgs; i++) {
+		if (msgs[i].flags & I2C_M_RD) {
+			memcpy(msgs[i].buf, &rspbuf[sizeof(*rsp) + rlen], msgs[i].len);
+			rlen += msgs[i].len;
+		}
+	}
+
+	return rsp->ret;
+}
+
+static int dev_transfer(int fd, struct i2c_msg *msgs, int nmsgs)
+{
+	struct i2c_rdwr_ioctl_data packets;
+
+	packets.msgs = msgs;
+	packets.nmsgs = nmsgs;
+
+	return ioctl(fd, I2C_RDWR, &packets);
+}
+
+/* Same return value as ioctl(fd, I2C_RDWR, ...) */
+int i2cbus_transfer(int fd, struct i2c_msg *msgs, int nmsgs)
+{
+	return i2cbus_backend(fd)->transfer(fd, msgs, nmsgs);
+}
+
+/* Opens /dev/i2c-<bus>, returns the fd or -1 */
+int i2cbus_open(int bus)
+{
+	char path[32];
+
+	if (use_sim())
+		return sim_open();
+
+	snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+	return open(path, O_RDWR | O_CLOEXEC);
+}
+
+/* I2C_SLAVE_FORCE on /dev/i2c-* devices, other backends don't need it */
+int i2cbus_set_slave(int fd, int i2caddr)
+{
+	if (i2cbus_backend(fd) != &dev_backend)
+		return 0;
+
+	return ioctl(fd, I2C_SLAVE_FORCE, i2caddr);
+}
@@ -0,0 +1,28 @@
+#ifndef __I2CBUS_H_
+#define __I2CBUS_H_
+
+struct i2c_msg;
+
+/* Bus number meaning the 21a0000.i2c adapter with the FPGA and RTC */
+#define I2CBUS_FPGA -1
+
+/* Adapter numbers found by name, only valid for the boot they were found in */
+#define I2CBUS_CACHE "/run/ts4900-utils-i2cbus"
+
+/* Flags for i2cbus_find_adapter() */
+#define I2CBUS_FIND_NOCACHE (1 << 0) /* Ignore and do not update the cache */
+#define I2CBUS_FIND_SCAN (1 << 1) /* Skip the platform device lookup */
+
+int i2cbus_find_adapter(const char *name, int flags);
+int i2cbus_open_adapter(const char *name);
+int i2cbus_open(int bus);
+int i2cbus_set_slave(int fd, int i2caddr);
+int i2cbus_transfer(int fd, struct i2c_msg *msgs, int nmsgs);
+int i2cbus_connect(int bus);
+int i2cbus_model(void);
+int i2cbus_simulated(void);
+int i2cbus_cache_get(const char *path, const char *key);
+void i2cbus_cache_put(const char *path, const char *key, int value);
+void i2cbus_set_direct(int direct);
+
+#endif
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/i2c.h>
+
+#include "fpga.h"
+#include "i2csim.h"
+#include "microadc.h"
+#include "crossbar-ts4900.h"
+#include "crossbar-ts7970.h"
+#include "crossbar-ts7990.h"
+
+/*
+ * Simulated I2C bus
+ *
+ * Used when TS_I2C_BACKEND=sim so the utilities can be run and benchmarked
+ * without hardware.  The bus has the FPGA at 0x28 as a 64K register file,
+ * the ISL12022 RTC at 0x6f and the microcontroller at 0x10 (TS-7970) or 0x4a
+ * (TS-7990).  State only lives as long as the process.
+ *
+ * Every transfer takes as long as it would on a real bus:
+ *
+ *   TS_I2C_SIM_MODEL    Board to simulate, 4900, 7970 (default) or 7990
+ *   TS_I2C_SIM_KHZ      Bus clock, default 400
+ *   TS_I2C_SIM_XFER_US  Fixed cost of each I2C_RDWR, default 30
+ *   TS_I2C_SIM_SUPERCAP_MV  TS-7990 supercap voltage, default 11800
+ *   TS_I2C_SIM_MICROREV  Microcontroller revision, default 6
+ *   TS_I2C_SIM_RTC_PPB  How fast the RTC runs before its offset, default 0
+ *
+ * The RTC counts from the time the process started at CLOCK_MONOTONIC's
+ * rate plus its drift, and an offset applied through the offset control
+ * register changes that rate the way it would on the part.
+ */
+
+#define FPGA_ADDR 0x28
+#define RTC_ADDR 0x6f
+#define RTC_REGS 0x30
+#define MICRO_FRAME 38
+
+struct sim_state {
+	int init;
+	int model;
+	int khz;
+	int xfer_us;
+	uint16_t micro_addr;
+
+	uint8_t fpga[65536];
+	uint16_t fpga_ptr;
+
+	uint8_t rtc[RTC_REGS];
+	uint8_t rtc_ptr;
+	long rtc_drift_ppb;
+	long rtc_ppb; /* Drift plus the applied offset */
+	uint64_t rtc_ns; /* RTC time in ns since the epoch at rtc_mono_ns */
+	uint64_t rtc_mono_ns;
+
+	uint8_t micro[MICRO_FRAME];
+	int micro_rev;
+	uint16_t micro_ptr;
+};
+
+static struct sim_state sim;
+
+/* Nominal rail voltages in mV and their dividers, converted to the raw
+ * 10 bit 0-2.5V values the microcontroller reports */
+struct sim_rail {
+	int mv;
+	int r1, r2;
+};
+
+static const struct sim_rail ts7970_rails[] = {
+	{ 1400, 0, 1 },	   /* VDD_ARM_CAP */
+	{ 2450, 0, 1 },	   /* VDD_HIGH_CAP */
+	{ 1250, 0, 1 },	   /* VDD_SOC_CAP */
+	{ 1400, 0, 1 },	   /* VDD_ARM */
+	{ 1320, 0, 1 },	   /* P10, 12mA through 110 ohm */
+	{ 1320, 0, 1 },	   /* P11 */
+	{ 1320, 0, 1 },	   /* P12 */
+	{ 12000, 2870, 147 }, /* VIN */
+	{ 5000, 147, 107 },   /* V5_A */
+	{ 3100, 499, 499 },   /* V3P1 */
+	{ 1500, 0, 1 },	   /* DDR_1P5V */
+	{ 1800, 0, 1 },	   /* V1P8 */
+	{ 1200, 0, 1 },	   /* V1P2 */
+	{ 750, 0, 1 },	   /* RAM_VREF */
+	{ 3300, 499, 499 },   /* V3P3 */
+	{ -1, 0, 0 },
+};
+
+static const struct sim_rail ts7990_rails[] = {
+	{ 12000, 2870, 147 }, /* VIN */
+	{ 5000, 147, 107 },   /* V5_A */
+	{ 20000, 121, 1 },    /* AN_LCD_20V */
+	{ 1500, 0, 1 },	   /* DDR_1P5V */
+	{ 1800, 0, 1 },	   /* V1P8 */
+	{ 11800, 100, 22 },   /* SUPERCAP */
+	{ 6000, 2870, 147 },  /* BACK_LT_RAW */
+	{ 3300, 499, 499 },   /* V3P3 */
+	{ 1400, 0, 1 },	   /* VDD_ARM_CAP */
+	{ 1250, 0, 1 },	   /* VDD_SOC_CAP */
+	{ -1, 0, 0 },
+};
+
+static uint8_t to_bcd(int val)
+{
+	return ((val / 10) << 4) | (val % 10);
+}
+
+static void sim_fpga_init(void)
+{
+	struct cbarpin *inputs, *outputs;
+	int shift;
+	int i, j;
+
+	if (sim.model == 0x4900) {
+		inputs = ts4900_inputs;
+		outputs = ts4900_outputs;
+		shift = 3;
+	} else if (sim.model == 0x7990) {
+		inputs = ts7990_inputs;
+		outputs = ts7990_outputs;
+		shift = 2;
+	} else {
+		inputs = ts7970_inputs;
+		outputs = ts7970_outputs;
+		shift = 2;
+	}
+
+	/* Route each input to the output of the same name, or GPIO */
+	for (i = 0; inputs[i].name != 0; i++) {
+		int mode = 31;
+
+		for (j = 0; outputs[j].name != 0; j++) {
+			if (strcmp(inputs[i].name, outputs[j].name) == 0)
+				mode = outputs[j].addr;
+		}
+		sim.fpga[inputs[i].addr] = mode << shift;
+	}
+
+	/* FPGA rev 12, no build options */
+	sim.fpga[51] = 0xc0;
+}
+
+static int env_int(const char *name, int def, int base)
+{
+	const char *val = getenv(name);
+
+	return val ? (int)strtol(val, NULL, base) : def;
+}
+
+static void sim_micro_init(void)
+{
+	const struct sim_rail *rails = sim.model == 0x7990 ? ts7990_rails : ts7970_rails;
+	int i;
+
+	for (i = 0; rails[i].mv >= 0; i++) {
+		int mv = rails[i].mv;
+		int raw;
+
+		if (sim.model == 0x7990 && i == TS7990_SUPERCAP_CHAN)
+			mv = env_int("TS_I2C_SIM_SUPERCAP_MV", mv, 10);
+		raw = (mv * rails[i].r2 / (rails[i].r1 + rails[i].r2)) * 1023 / 2500;
+
+		if (raw > 1023)
+			raw = 1023;
+		sim.micro[i * 2] = raw >> 8;
+		sim.micro[i * 2 + 1] = raw & 0xff;
+	}
+
+	/* Rev 6 and later have a MAC address */
+	sim.micro_rev = env_int("TS_I2C_SIM_MICROREV", 6, 10);
+	if (sim.model == 0x7970)
+		sim.micro[30] = sim.micro_rev >> 8;
+	sim.micro[31] = sim.micro_rev;
+	/* 00:d0:69:12:34:56, stored as 16 bit words */
+	memcpy(&sim.micro[32], "\xd0\x00\x12\x69\x56\x34", 6);
+}
+
+static uint64_t sim_mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t sim_rtc_ns(void)
+{
+	uint64_t elapsed = sim_mono_ns() - sim.rtc_mono_ns;
+
+	return sim.rtc_ns + elapsed + (int64_t)((double)elapsed * sim.rtc_ppb / 1e9);
+}
+
+/* Carries on from where the RTC has got to at a new rate */
+static void sim_rtc_rate(long ppb)
+{
+	sim.rtc_ns = sim_rtc_ns();
+	sim.rtc_mono_ns = sim_mono_ns();
+	sim.rtc_ppb = ppb;
+}
+
+/* Latches the time into the time registers, as the part does when a read
+ * starts */
+static void sim_rtc_time(void)
+{
+	time_t now = sim_rtc_ns() / 1000000000;
+	struct tm tm;
+
+	gmtime_r(&now, &tm);
+	sim.rtc[0x00] = to_bcd(tm.tm_sec);
+	sim.rtc[0x01] = to_bcd(tm.tm_min);
+	sim.rtc[0x02] = to_bcd(tm.tm_hour) | 0x80; /* 24 hour mode */
+	sim.rtc[0x03] = to_bcd(tm.tm_mday);
+	sim.rtc[0x04] = to_bcd(tm.tm_mon + 1);
+	sim.rtc[0x05] = to_bcd(tm.tm_year % 100);
+	sim.rtc[0x06] = tm.tm_wday;
+}
+
+static void sim_rtc_init(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	sim.rtc_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	sim.rtc_mono_ns = sim_mono_ns();
+	sim.rtc_drift_ppb = env_int("TS_I2C_SIM_RTC_PPB", 0, 10);
+	sim.rtc_ppb = sim.rtc_drift_ppb;
+	sim_rtc_time();
+
+	/* 25C, the sensor reports in half degrees Kelvin */
+	sim.rtc[0x28] = 596 & 0xff;
+	sim.rtc[0x29] = 596 >> 8;
+}
+
+static void sim_init(void)
+{
+	if (sim.init)
+		return;
+
+	sim.model = env_int("TS_I2C_SIM_MODEL", 0x7970, 16);
+	if (sim.model != 0x4900 && sim.model != 0x7970 && sim.model != 0x7990)
+		sim.model = 0x7970;
+	sim.khz = env_int("TS_I2C_SIM_KHZ", 400, 10);
+	if (sim.khz < 1)
+		sim.khz = 400;
+	sim.xfer_us = env_int("TS_I2C_SIM_XFER_US", 30, 10);
+	sim.micro_addr = sim.model == 0x7990 ? 0x4a : 0x10;
+
+	sim_fpga_init();
+	sim_micro_init();
+	sim_rtc_init();
+	sim.init = 1;
+}
+
+int i2csim_model(void)
+{
+	sim_init();
+	return sim.model;
+}
+
+static void sim_fpga(struct i2c_msg *msg)
+{
+	int i = 0;
+
+	if (msg->flags & I2C_M_RD) {
+		for (i = 0; i < msg->len; i++)
+			msg->buf[i] = sim.fpga[sim.fpga_ptr++];
+		return;
+	}
+
+	if (msg->len >= 2) {
+		sim.fpga_ptr = (msg->buf[0] << 8) | msg->buf[1];
+		i = 2;
+	}
+	for (; i < msg->len; i++)
+		sim.fpga[sim.fpga_ptr++] = msg->buf[i];
+}
+
+static void sim_rtc(struct i2c_msg *msg)
+{
+	int apply = 0;
+	long offset;
+	int i = 0;
+
+	if (msg->flags & I2C_M_RD) {
+		sim_rtc_time();
+		for (i = 0; i < msg->len; i++) {
+			msg->buf[i] = sim.rtc[sim.rtc_ptr];
+			sim.rtc_ptr = (sim.rtc_ptr + 1) % RTC_REGS;
+		}
+		return;
+	}
+
+	if (msg->len >= 1) {
+		sim.rtc_ptr = msg->buf[0] % RTC_REGS;
+		i = 1;
+	}
+	for (; i < msg->len; i++) {
+		if (sim.rtc_ptr == 0x25 && (msg->buf[i] & 0x1))
+			apply = 1;
+		sim.rtc[sim.rtc_ptr] = msg->buf[i];
+		sim.rtc_ptr = (sim.rtc_ptr + 1) % RTC_REGS;
+	}
+
+	/* The offset is ppb LSB first in 0x21-0x24, added or subtracted by
+	 * bit 1 of 0x25 */
+	if (apply) {
+		offset = (uint32_t)sim.rtc[0x21] | (uint32_t)sim.rtc[0x22] << 8 | (uint32_t)sim.rtc[0x23] << 16 |
+			 (uint32_t)sim.rtc[0x24] << 24;
+		if (!(sim.rtc[0x25] & 0x2))
+			offset = -offset;
+		sim_rtc_rate(sim.rtc_drift_ppb + offset);
+	}
+}
+
+/* Reads start from the beginning of the ADC frame, unless a TS-7970 with
+ * rev 6 or later was just sent a 2 byte register address the way
+ * speekstream16() sends it.  Other writes are commands such as sleep which
+ * have no effect here. */
+static void sim_micro(struct i2c_msg *msg, struct i2c_msg *next)
+{
+	int i;
+
+	if (!(msg->flags & I2C_M_RD)) {
+		if (msg->len == 2 && next && (next->flags & I2C_M_RD) && sim.model == 0x7970 && sim.micro_rev >= 6)
+			sim.micro_ptr = msg->buf[0] | (msg->buf[1] << 8);
+		return;
+	}
+
+	for (i = 0; i < msg->len; i++)
+		msg->buf[i] = sim.micro_ptr + i < MICRO_FRAME ? sim.micro[sim.micro_ptr + i] : 0;
+	sim.micro_ptr = 0;
+}
+
+/* Wait until the bus would have finished, spinning since the times involved
+ * are usually shorter than the scheduler can sleep for accurately */
+static void sim_delay(uint64_t ns)
+{
+	struct timespec start, now;
+	uint64_t elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000000000ULL + now.tv_nsec - start.tv_nsec;
+	} while (elapsed < ns);
+}
+
+int i2csim_transfer(int fd, struct i2c_msg *msgs, int nmsgs)
+{
+	uint64_t bits = 0;
+	int i;
+
+	sim_init();
+
+	for (i = 0; i < nmsgs; i++) {
+		/* (Re)start, address byte, data bytes, each byte plus ack */
+		bits += 1 + 9 * (1 + msgs[i].len);
+
+		if (msgs[i].addr == FPGA_ADDR) {
+			sim_fpga(&msgs[i]);
+		} else if (msgs[i].addr == RTC_ADDR) {
+			sim_rtc(&msgs[i]);
+		} else if (msgs[i].addr == sim.micro_addr && sim.model != 0x4900) {
+			sim_micro(&msgs[i], i + 1 < nmsgs ? &msgs[i + 1] : NULL);
+		} else {
+			sim_delay(sim.xfer_us * 1000ULL + bits * 1000000ULL / sim.khz);
+			errno = ENXIO;
+			return -1;
+		}
+	}
+	bits++; /* Stop */
+
+	sim_delay(sim.xfer_us * 1000ULL + bits * 1000000ULL / sim.khz);
+
+	return nmsgs;
+}
@@ -0,0 +1,9 @@
+#ifndef __I2CSIM_H_
+#define __I2CSIM_H_
+
+struct i2c_msg;
+
+int i2csim_transfer(int fd, struct i2c_msg *msgs, int nmsgs);
+int i2csim_model(void);
+
+#endif
@@ -1,6 +1,5 @@
 #include <stdio.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -9,282 +8,357 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
+#include <getopt.h>
 #include <assert.h>
+#include <sys/timex.h>
 
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
-#define ISL12022_REG_OFF_VAL 0x21
-#define ISL12022_REG_OFF_CTL 0x25
-#define ISL12022_OFF_CTL_APPLY (1 << 0) /* Make value take affect now */
-#define ISL12022_OFF_CTL_ADD (1 << 1) /* 1 if the value is add, 0 if subtract */
-#define ISL12022_OFF_CTL_FLASH (1 << 2) /* 1 to commit to flash, 0 to just ram */
+#include "i2cbus.h"
+#include "isl12022.h"
+
+#define CAL_WINDOW_S 600
+#define CAL_MIN_WINDOW_S 10
+#define CAL_THRESHOLD_PPB 250
+#define CAL_STEP_S 2 /* Between the RTC edges timed, at most */
+#define CAL_LEAD_NS 5000000ULL /* Polling starts this far before an edge */
+#define CAL_EDGE_TIMEOUT_NS 3000000000ULL
 
 int rtc_init(void)
 {
 	static int fd = -1;
-	DIR *d;
-	struct dirent *dir;
 
 	if (fd != -1)
 		return fd;
 
-	// Depending on which baseboard the TS-4900 is used on there
-	// May be a different number of /dev/i2c-* devices.  This will
-	// search for the name 21a0000.i2c where the name is the
-	// memory address in the imx6 of the correct i2c bus.
-	d = opendir("/sys/bus/i2c/devices/");
-	if (d == NULL) {
-		perror("Unable to open i2c sys directory");
-		return -1;
-	}
+	fd = i2cbus_connect(I2CBUS_FPGA);
+	if (fd != -1)
+		return fd;
 
-	while ((dir = readdir(d)) != NULL) {
-		char path[512], busname[512];
-		int namefd;
-		snprintf(path, 512, "/sys/bus/i2c/devices/%s/name", dir->d_name);
-		namefd = open(path, O_RDONLY);
-		if (namefd == -1)
-			continue;
-		if (read(namefd, busname, 512) == -1) {
-			perror("Unable to read from bus name file");
-			fd = -1;
-			break;
-		}
-		if (strncmp(busname, "21a0000.i2c", 11) == 0) {
-			snprintf(path, 512, "/dev/%s", dir->d_name);
-			fd = open(path, O_RDWR);
-			if (fd < 0) {
-				perror("Unable to open RTC");
-				break;
-			}
-		}
-	}
-	closedir(d);
+	// The memory address in the imx6 of the correct i2c bus
+	fd = i2cbus_open_adapter("21a0000.i2c");
+	if (fd < 0)
+		perror("Unable to open RTC");
 
 	return fd;
 }
 
-int rtc_read(int i2cfd, uint8_t addr, void *data, uint8_t len)
+int rtc_clear_time_stamp(int i2cfd, const struct isl12022_snap *snap)
 {
-	struct i2c_rdwr_ioctl_data packets;
-	struct i2c_msg msgs[2];
-	int ret;
-
-	msgs[0].addr = 0x6f;
-	msgs[0].flags = 0;
-	msgs[0].len = 1;
-	msgs[0].buf = &addr;
-
-	msgs[1].addr = 0x6f;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = len;
-	msgs[1].buf = (uint8_t *)data;
-
-	packets.msgs = msgs;
-	packets.nmsgs = 2;
-
-	/* I2C_RDWR will return < 0 on error, or the number of messages that
-	 * were transferred. We should always have two since we are only ever
-	 * sending a write followed by a read.
-	 */
-	ret = ioctl(i2cfd, I2C_RDWR, &packets);
-	if (ret < 0)
-		perror("Unable to read data");
-	else if (ret == 2)
-		ret = 0;
-	else
-		ret = -1;
-
-	return ret;
-}
+	uint8_t data = snap->reg[ISL12022_REG_PWR_VDD] | ISL12022_PWR_VDD_CLRTS;
 
-int rtc_write(int i2cfd, uint8_t addr, uint8_t data)
-{
-	struct i2c_rdwr_ioctl_data packets;
-	struct i2c_msg msg;
-	int ret;
-	uint8_t tmp[2];
-
-	tmp[0] = addr;
-	tmp[1] = data;
-
-	msg.addr = 0x6f;
-	msg.flags = 0;
-	msg.len = 2;
-	msg.buf = tmp;
-
-	packets.msgs = &msg;
-	packets.nmsgs = 1;
-
-	/* I2C_RDWR will return < 0 on error, or the number of messages that
-	 * were transferred. We should always have one since we are only ever
-         * sending a single transfer.
-	 */
-	ret = ioctl(i2cfd, I2C_RDWR, &packets);
-	if (ret < 0)
-		perror("Unable to read data");
-	else if (ret == 1)
-		ret = 0;
-	else
-		ret = -1;
+	if (isl12022_write(i2cfd, ISL12022_REG_PWR_VDD, &data, 1) < 0) {
+		fprintf(stderr, "Unable to clear timestamp\n");
+		return -1;
+	}
 
-	return ret;
+	return 0;
 }
 
-/* Return temp n millicelcius */
-int rtc_temp_read(int i2cfd, int *mc)
+int rtc_offset_set(int i2cfd, long offset)
 {
-	uint8_t data[2];
-
-	if (rtc_read(i2cfd, 0x28, data, 2) < 0)
-		return -1;
+	uint32_t ppb = labs(offset);
+	uint8_t data[5];
+	int i;
 
-	/* Convert from Kelvin to millicelsius */
-	*mc = ((data[0] | (data[1] << 8)) * 500) - 273000;
+	/* The ppb goes LSB first in the offset registers, and the control
+	 * register follows them, so it is all one write */
+	for (i = 0; i < 4; i++)
+		data[i] = (uint8_t)((ppb >> (i * 8)) & 0xff);
+	data[4] = ISL12022_OFF_CTL_APPLY |
+		  ((offset > 0) ? ISL12022_OFF_CTL_ADD : 0) |
+		  ISL12022_OFF_CTL_FLASH;
 
-	return 0;
+	return isl12022_write(i2cfd, ISL12022_REG_OFF_VAL, data, sizeof(data));
 }
 
-int bcd_to_decimal(uint8_t bcd)
+static uint64_t now_ns(void)
 {
-	int dec;
-	dec = ((bcd & 0xf0) >> 4) * 10 + (bcd & 0xf);
-	return dec;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-int rtc_tsv2b_read(int i2cfd, struct tm *ts)
+/* Polls the RTC back to back until its seconds change.  The change happened
+ * between the last two reads, so it is put halfway between their midpoints
+ * in *edge_ns, and the new time of day in *sod.  *spacing keeps the
+ * shortest time between two reads seen.  An edge bracketed by reads much
+ * further apart than that, from being preempted, is known less well than
+ * the others, so it is skipped and the next one is used. */
+static int rtc_edge(int i2cfd, uint64_t *edge_ns, int *sod, uint64_t *spacing)
 {
-	time_t now;
-	uint8_t data[5];
+	uint64_t start, t0, t1, mid, prev_mid;
+	int prev, cur;
 
-	if (rtc_read(i2cfd, 0x16, data, 5) < 0)
+	start = now_ns();
+	prev = isl12022_read_sod(i2cfd);
+	if (prev < 0)
 		return -1;
-	time(&now);
-	gmtime_r(&now, ts);
-
-	ts->tm_sec = bcd_to_decimal(data[0] & 0x7f);
-	ts->tm_min = bcd_to_decimal(data[1] & 0x7f);
-	ts->tm_hour = bcd_to_decimal(data[2] & 0x3f);
-	ts->tm_mday = bcd_to_decimal(data[3] & 0x3f);
-	ts->tm_mon = bcd_to_decimal(data[4] & 0x1f) - 1; /* hardware is 1-12, remove 1 to match 0 numbering*/
-	/* Year will always match current year! */
+	prev_mid = (start + now_ns()) / 2;
 
-	return 0;
+	for (;;) {
+		t0 = now_ns();
+		cur = isl12022_read_sod(i2cfd);
+		t1 = now_ns();
+		if (cur < 0)
+			return -1;
+		mid = (t0 + t1) / 2;
+		if (mid - prev_mid < *spacing)
+			*spacing = mid - prev_mid;
+		if (cur != prev && mid - prev_mid <= *spacing + *spacing / 4) {
+			*edge_ns = (prev_mid + mid) / 2;
+			*sod = cur;
+			return 0;
+		}
+		if (t1 - start > CAL_EDGE_TIMEOUT_NS) {
+			fprintf(stderr, "RTC seconds are not counting\n");
+			return -1;
+		}
+		prev = cur;
+		prev_mid = mid;
+	}
 }
 
-int rtc_tsb2v_read(int i2cfd, struct tm *ts)
+/*
+ * Least squares fit of r = a + slope * x.  Returns the slope and its
+ * standard error in *err, taking each r to be off by at least sd.  That
+ * assumes the errors in r are independent, so if the residuals say
+ * otherwise the error is widened to match: with a lag one correlation rho
+ * the fit has (1 - rho) / (1 + rho) as many points' worth of information.
+ */
+static double fit_slope(const double *x, const double *r, int n, double sd, double *err)
 {
-	time_t now;
-	uint8_t data[5];
+	double mx = 0, mr = 0, sxx = 0, sxr = 0, see = 0, se1 = 0;
+	double slope, e, prev = 0, rho;
+	int i;
 
-	if (rtc_read(i2cfd, 0x1b, data, 5) < 0)
-		return -1;
-	time(&now);
-	gmtime_r(&now, ts);
+	for (i = 0; i < n; i++) {
+		mx += x[i] / n;
+		mr += r[i] / n;
+	}
+	for (i = 0; i < n; i++) {
+		sxx += (x[i] - mx) * (x[i] - mx);
+		sxr += (x[i] - mx) * (r[i] - mr);
+	}
+	slope = sxr / sxx;
+
+	for (i = 0; i < n; i++) {
+		e = r[i] - mr - slope * (x[i] - mx);
+		see += e * e;
+		if (i > 0)
+			se1 += e * prev;
+		prev = e;
+	}
 
-	ts->tm_sec = bcd_to_decimal(data[0] & 0x7f);
-	ts->tm_min = bcd_to_decimal(data[1] & 0x7f);
-	ts->tm_hour = bcd_to_decimal(data[2] & 0x3f);
-	ts->tm_mday = bcd_to_decimal(data[3] & 0x3f);
-	ts->tm_mon = bcd_to_decimal(data[4] & 0x1f) - 1; /* hardware is 1-12, remove 1 to match 0 numbering*/
-	/* Year will always match current year! */
+	rho = see > 0 ? se1 / see : 0;
+	if (see / (n - 2) < sd * sd)
+		see = sd * sd * (n - 2);
+	*err = sqrt(see / (n - 2) / sxx);
+	if (rho > 0.9)
+		rho = 0.9;
+	if (rho > 0)
+		*err *= sqrt((1 + rho) / (1 - rho));
 
-	return 0;
+	return slope;
 }
 
-int rtc_clear_time_stamp(int i2cfd)
+/* Times the RTC's seconds against CLOCK_MONOTONIC, which NTP or PTP keeps
+ * at the right rate without ever stepping it, over window seconds.  The
+ * slope of how far the RTC got ahead against the time elapsed is its drift
+ * with the current offset applied, so the offset that cancels it is the
+ * current one less the drift.  It is only written, and so committed to the
+ * RTC's flash, if it moved by more than threshold and by more than the fit
+ * can tell apart. */
+static int rtc_calibrate(int i2cfd, int window, long threshold, int dry_run, int force)
 {
-	uint8_t data;
-
-	if (rtc_read(i2cfd, 0x09, &data, 1) < 0) {
-		fprintf(stderr, "Unable to read timestamp\n");
+	struct isl12022_snap snap;
+	struct timespec ts;
+	struct timex tx;
+	uint64_t first_ns, edge_ns, next, spacing = UINT64_MAX;
+	double *x, *r, slope, err;
+	long offset, new_offset, drift;
+	int step, npoints, state, written = 0;
+	int sod, rtc_s, first_s, last_s, i;
+	int ret = -1;
+
+	memset(&tx, 0, sizeof(tx));
+	state = adjtimex(&tx);
+	if (!force && (state < 0 || state == TIME_ERROR || (tx.status & STA_UNSYNC))) {
+		fprintf(stderr, "The system clock is not synchronized, use --force to calibrate against it anyway\n");
 		return -1;
 	}
 
-	data |= (1 << 7); /* CLRTS */
-	if (rtc_write(i2cfd, 0x09, data) < 0) {
-		fprintf(stderr, "Unable to clear timestamp\n");
+	if (isl12022_snapshot(i2cfd, &snap) < 0)
 		return -1;
+	offset = isl12022_offset_ppb(&snap);
+
+	step = window / 10 < CAL_STEP_S ? window / 10 : CAL_STEP_S;
+	npoints = window / step + 1;
+	x = malloc(npoints * sizeof(*x));
+	r = malloc(npoints * sizeof(*r));
+	if (x == NULL || r == NULL) {
+		perror("malloc");
+		goto out;
 	}
+	fprintf(stderr, "Timing %d RTC seconds over %d s\n", npoints, window);
 
-	return 0;
-}
-
-int rtc_is_emulated(int i2cfd, int *emulated)
-{
-	uint8_t data;
-
-	if (rtc_read(i2cfd, 0x0f, &data, 1) < 0)
-		return -1;
+	srandom(now_ns());
+	if (rtc_edge(i2cfd, &first_ns, &sod, &spacing) < 0)
+		goto out;
+	first_s = last_s = sod;
+	edge_ns = first_ns;
+
+	for (i = 0; i < npoints; i++) {
+		if (i > 0) {
+			/* Polling starts at a random point so where the edge
+			 * falls between two reads is new each time.  From a
+			 * fixed point it barely moves from one edge to the next,
+			 * the errors come out the same, and the fit only sees
+			 * them step when the drift carries the edge past a read. */
+			next = edge_ns + step * 1000000000ULL - CAL_LEAD_NS + random() % (CAL_LEAD_NS / 2);
+			ts.tv_sec = next / 1000000000;
+			ts.tv_nsec = next % 1000000000;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+				;
+			if (rtc_edge(i2cfd, &edge_ns, &sod, &spacing) < 0)
+				goto out;
+		}
 
-	*emulated = !!(data & (1 << 7));
-	return 0;
-}
+		/* Count on across midnight */
+		rtc_s = last_s - last_s % 86400 + sod;
+		if (rtc_s < last_s)
+			rtc_s += 86400;
+		last_s = rtc_s;
 
-int rtc_offset_set(int i2cfd, long offset)
-{
-	uint8_t data;
-	uint32_t ppb = labs(offset);
-	int i;
-
-	/* Write the ppb to the associated offset registers. This is written
-	 * LSB first.
-	 *
-	 * TODO: Rather than looping on a byte write, it would likely be possible
-	 * to modify the rtc_write() function to accept a number of bytes to
-	 * transmit.
-	 */
-	for (i = 0; i < 4; i++) {
-		data = (uint8_t)((ppb >> (i*8)) & 0xff);
-		if (rtc_write(i2cfd, ISL12022_REG_OFF_VAL + i, data) < 0)
-			return -1;
+		x[i] = (edge_ns - first_ns) / 1e9;
+		r[i] = (rtc_s - first_s) - x[i];
 	}
 
-	data = ISL12022_OFF_CTL_APPLY |
-	       ((offset > 0) ? ISL12022_OFF_CTL_ADD : 0) |
-	       ISL12022_OFF_CTL_FLASH;
+	/* An edge is only known to somewhere between two reads */
+	slope = fit_slope(x, r, npoints, spacing / 1e9 / sqrt(12), &err);
+	drift = lround(slope * 1e9);
+	new_offset = offset - drift;
+	/* A change inside the noise of the fit is not worth a flash write either */
+	if (labs(new_offset - offset) > threshold && labs(new_offset - offset) > 3 * lround(err * 1e9) && !dry_run) {
+		if (rtc_offset_set(i2cfd, new_offset) < 0)
+			goto out;
+		written = 1;
+	}
 
-	if (rtc_write(i2cfd, ISL12022_REG_OFF_CTL, data) < 0)
-			return -1;
+	printf("drift_ppb=%ld\n", drift);
+	printf("drift_uncertainty_ppb=%ld\n", lround(err * 1e9));
+	printf("offset_ppb=%ld\n", offset);
+	printf("new_offset_ppb=%ld\n", new_offset);
+	printf("offset_written=%d\n", written);
+	ret = 0;
 
-	return 0;
+out:
+	free(x);
+	free(r);
+	return ret;
 }
 
-int rtc_offset_get(int i2cfd, long *offset)
+static void usage(char **argv)
 {
-	uint8_t data;
-	uint32_t ppb;
-
-	if (rtc_read(i2cfd, ISL12022_REG_OFF_VAL, &ppb, (sizeof(ppb))) < 0)
-		return -1;
-	if (rtc_read(i2cfd, ISL12022_REG_OFF_CTL, &data, 1) < 0)
-		return -1;
-
-	*offset = ppb;
-
-	if ((data & ISL12022_OFF_CTL_ADD) == 0)
-		*offset *= -1;
-
-	return 0;
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] [ppm]\n"
+		"embeddedTS ISL12020/ISL12022 RTC utility\n"
+		"\n"
+		"  -c, --calibrate          Measure the RTC drift against the system clock\n"
+		"                             and correct the offset for it\n"
+		"  -w, --window <s>         Seconds to measure for, default %d\n"
+		"  -t, --threshold <ppb>    Only write the offset if it changes by more than\n"
+		"                             this and 3x the uncertainty, default %d\n"
+		"  -n, --dry-run            Measure but never write the offset\n"
+		"  -f, --force              Calibrate even if the system clock is not\n"
+		"                             synchronized\n"
+		"  -h, --help               This message\n"
+		"\n"
+		"With no options, prints the RTC temperature, power fail timestamps and\n"
+		"offset, then clears the timestamps.  A ppm argument first sets the offset\n"
+		"to correct an RTC that is that many ppm fast.\n"
+		"\n",
+		argv[0], CAL_WINDOW_S, CAL_THRESHOLD_PPB);
 }
 
 int main(int argc, char **argv)
 {
-	int i2cfd;
-	int temp;
+	struct isl12022_snap snap;
 	struct tm tsv2b, tsb2v;
 	char tmbuf[64];
-	long offset;
-	int emulated;
+	char *end = NULL;
+	int calibrate = 0, dry_run = 0, force = 0;
+	int window = CAL_WINDOW_S;
+	long threshold = CAL_THRESHOLD_PPB;
+	int i2cfd;
+	int c;
 	int ret = 1;
 
+	static struct option long_options[] = { { "calibrate", no_argument, 0, 'c' },
+						{ "window", required_argument, 0, 'w' },
+						{ "threshold", required_argument, 0, 't' },
+						{ "dry-run", no_argument, 0, 'n' },
+						{ "force", no_argument, 0, 'f' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	/* A lone ppm, which may be negative, is the original usage */
+	if (argc == 2)
+		strtod(argv[1], &end);
+	if (end == NULL || *end != '\0' || end == argv[1]) {
+		while ((c = getopt_long(argc, argv, "cw:t:nfh", long_options, NULL)) != -1) {
+			switch (c) {
+			case 'c':
+				calibrate = 1;
+				break;
+			case 'w':
+				window = atoi(optarg);
+				break;
+			case 't':
+				threshold = atol(optarg);
+				break;
+			case 'n':
+				dry_run = 1;
+				break;
+			case 'f':
+				force = 1;
+				break;
+			case 'h':
+				usage(argv);
+				return 0;
+			default:
+				usage(argv);
+				return 1;
+			}
+		}
+		if (optind != argc) {
+			usage(argv);
+			return 1;
+		}
+		if (window < CAL_MIN_WINDOW_S) {
+			fprintf(stderr, "The window must be at least %d s\n", CAL_MIN_WINDOW_S);
+			return 1;
+		}
+		if (threshold < 0) {
+			fprintf(stderr, "The threshold cannot be negative\n");
+			return 1;
+		}
+	}
+
 	i2cfd = rtc_init();
 	if (i2cfd == -1)
 		return 1;
 
+	if (calibrate) {
+		ret = rtc_calibrate(i2cfd, window, threshold, dry_run, force) < 0;
+		goto out;
+	}
+
 	/* Set PPM value if specified */
-	if (argc == 2) {
+	if (argc == 2 && end && *end == '\0' && end != argv[1]) {
 		float ppm = atof(argv[1]);
 		long ppb = (long)(ppm * 1000 * -1);
 
@@ -292,29 +366,25 @@ int main(int argc, char **argv)
 			goto out;
 	}
 
-	if (rtc_temp_read(i2cfd, &temp) < 0)
+	/* Everything below comes from this one read */
+	if (isl12022_snapshot(i2cfd, &snap) < 0)
 		goto out;
-	printf("rtctemp_millicelcius=%d\n", temp);
 
-	if (rtc_tsv2b_read(i2cfd, &tsv2b) < 0)
-		goto out;
+	printf("rtctemp_millicelcius=%d\n", isl12022_temp_mc(&snap));
+
+	isl12022_timestamp(&snap, ISL12022_REG_TSV2B, &tsv2b);
 	strftime(tmbuf, 64, "%m-%d %H:%M:%S", &tsv2b);
 	printf("poweroff_utc_timestamp_tsv2b=\"%s\"\n", tmbuf);
 
-	if (rtc_tsb2v_read(i2cfd, &tsb2v) < 0)
-		goto out;
+	isl12022_timestamp(&snap, ISL12022_REG_TSB2V, &tsb2v);
 	strftime(tmbuf, 64, "%m-%d %H:%M:%S", &tsb2v);
 	printf("poweron_utc_timestamp_tsb2v=\"%s\"\n", tmbuf);
 
-	if (rtc_is_emulated(i2cfd, &emulated) < 0)
-		goto out;
-	printf("rtc_is_emulated=%d\n", emulated);
+	printf("rtc_is_emulated=%d\n", isl12022_emulated(&snap));
 
-	if (rtc_offset_get(i2cfd, &offset) < 0)
-		goto out;
-	printf("offset_ppb=%ld\n", offset);
+	printf("offset_ppb=%ld\n", isl12022_offset_ppb(&snap));
 
-	if (rtc_clear_time_stamp(i2cfd) < 0)
+	if (rtc_clear_time_stamp(i2cfd, &snap) < 0)
 		goto out;
 
 	ret = 0;
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/i2c.h>
+
+#include "i2cbus.h"
+#include "isl12022.h"
+
+int isl12022_read(int i2cfd, uint8_t addr, void *data, uint8_t len)
+{
+	struct i2c_msg msgs[2];
+	int ret;
+
+	msgs[0].addr = ISL12022_ADDR;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &addr;
+
+	msgs[1].addr = ISL12022_ADDR;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = len;
+	msgs[1].buf = (uint8_t *)data;
+
+	/* I2C_RDWR will return < 0 on error, or the number of messages that
+	 * were transferred. We should always have two since we are only ever
+	 * sending a write followed by a read.
+	 */
+	ret = i2cbus_transfer(i2cfd, msgs, 2);
+	if (ret < 0)
+		perror("Unable to read data");
+	else if (ret == 2)
+		ret = 0;
+	else
+		ret = -1;
+
+	return ret;
+}
+
+int isl12022_write(int i2cfd, uint8_t addr, const void *data, uint8_t len)
+{
+	struct i2c_msg msg;
+	uint8_t buf[1 + 255];
+	int ret;
+
+	buf[0] = addr;
+	memcpy(&buf[1], data, len);
+
+	msg.addr = ISL12022_ADDR;
+	msg.flags = 0;
+	msg.len = 1 + len;
+	msg.buf = buf;
+
+	/* The register address increments after every byte, so consecutive
+	 * registers go in one transfer */
+	ret = i2cbus_transfer(i2cfd, &msg, 1);
+	if (ret < 0)
+		perror("Unable to write data");
+	else if (ret == 1)
+		ret = 0;
+	else
+		ret = -1;
+
+	return ret;
+}
+
+int isl12022_snapshot(int i2cfd, struct isl12022_snap *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+
+	return isl12022_read(i2cfd, ISL12022_SNAP_FIRST, &snap->reg[ISL12022_SNAP_FIRST],
+			     ISL12022_SNAP_LAST - ISL12022_SNAP_FIRST + 1);
+}
+
+static int bcd_to_decimal(uint8_t bcd)
+{
+	return ((bcd & 0xf0) >> 4) * 10 + (bcd & 0xf);
+}
+
+/* Return temp in millicelcius */
+int isl12022_temp_mc(const struct isl12022_snap *snap)
+{
+	const uint8_t *data = &snap->reg[ISL12022_REG_TEMP];
+
+	/* Convert from Kelvin to millicelsius */
+	return ((data[0] | (data[1] << 8)) * 500) - 273000;
+}
+
+int isl12022_emulated(const struct isl12022_snap *snap)
+{
+	return !!(snap->reg[ISL12022_REG_EMU] & ISL12022_EMU);
+}
+
+long isl12022_offset_ppb(const struct isl12022_snap *snap)
+{
+	const uint8_t *data = &snap->reg[ISL12022_REG_OFF_VAL];
+	long offset;
+
+	offset = (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+	if ((snap->reg[ISL12022_REG_OFF_CTL] & ISL12022_OFF_CTL_ADD) == 0)
+		offset *= -1;
+
+	return offset;
+}
+
+int isl12022_read_sod(int i2cfd)
+{
+	uint8_t data[3];
+	int hour;
+
+	if (isl12022_read(i2cfd, ISL12022_REG_SC, data, sizeof(data)) < 0)
+		return -1;
+
+	if (data[2] & ISL12022_HR_MIL)
+		hour = bcd_to_decimal(data[2] & 0x3f);
+	else
+		hour = bcd_to_decimal(data[2] & 0x1f) % 12 + ((data[2] & ISL12022_HR_PM) ? 12 : 0);
+
+	return (hour * 60 + bcd_to_decimal(data[1] & 0x7f)) * 60 + bcd_to_decimal(data[0] & 0x7f);
+}
+
+void isl12022_timestamp(const struct isl12022_snap *snap, uint8_t reg, struct tm *ts)
+{
+	const uint8_t *data = &snap->reg[reg];
+	time_t now;
+
+	time(&now);
+	gmtime_r(&now, ts);
+
+	ts->tm_sec = bcd_to_decimal(data[0] & 0x7f);
+	ts->tm_min = bcd_to_decimal(data[1] & 0x7f);
+	ts->tm_hour = bcd_to_decimal(data[2] & 0x3f);
+	ts->tm_mday = bcd_to_decimal(data[3] & 0x3f);
+	ts->tm_mon = bcd_to_decimal(data[4] & 0x1f) - 1; /* hardware is 1-12, remove 1 to match 0 numbering*/
+	/* Year will always match current year! */
+}
@@ -0,0 +1,56 @@
+#ifndef __ISL12022_H_
+#define __ISL12022_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Register map of the ISL12022 RTC at 0x6f on the 21a0000.i2c bus, as the
+ * TS boards present it.  Everything isl12020rtc reports lives between
+ * ISL12022_SNAP_FIRST and ISL12022_SNAP_LAST, so one I2C_RDWR takes a
+ * snapshot of all of it and the fields are decoded from that.  The bus is
+ * shared with the FPGA, so the fewer transactions the better.
+ */
+#define ISL12022_ADDR 0x6f
+
+#define ISL12022_REG_SC 0x00 /* BCD seconds, minutes, hours */
+#define ISL12022_REG_HR 0x02
+#define ISL12022_HR_MIL (1 << 7) /* 24 hour mode */
+#define ISL12022_HR_PM (1 << 5) /* In 12 hour mode */
+
+#define ISL12022_REG_PWR_VDD 0x09
+#define ISL12022_PWR_VDD_CLRTS (1 << 7) /* Clear both timestamps */
+#define ISL12022_REG_EMU 0x0f
+#define ISL12022_EMU (1 << 7) /* Emulated by the microcontroller */
+#define ISL12022_REG_TSV2B 0x16 /* Switch to battery, BCD sec to month */
+#define ISL12022_REG_TSB2V 0x1b /* Back to VDD, the same way */
+#define ISL12022_TS_LEN 5
+#define ISL12022_REG_OFF_VAL 0x21 /* ppb, 4 bytes LSB first */
+#define ISL12022_REG_OFF_CTL 0x25
+#define ISL12022_OFF_CTL_APPLY (1 << 0) /* Make value take affect now */
+#define ISL12022_OFF_CTL_ADD (1 << 1) /* 1 if the value is add, 0 if subtract */
+#define ISL12022_OFF_CTL_FLASH (1 << 2) /* 1 to commit to flash, 0 to just ram */
+#define ISL12022_REG_TEMP 0x28 /* Half degrees Kelvin, 2 bytes LSB first */
+
+#define ISL12022_SNAP_FIRST ISL12022_REG_PWR_VDD
+#define ISL12022_SNAP_LAST (ISL12022_REG_TEMP + 1)
+
+struct isl12022_snap {
+	/* Indexed by register address, only the snapshot range is valid */
+	uint8_t reg[ISL12022_SNAP_LAST + 1];
+};
+
+int isl12022_read(int i2cfd, uint8_t addr, void *data, uint8_t len);
+/* Writes len bytes to consecutive registers in one transaction */
+int isl12022_write(int i2cfd, uint8_t addr, const void *data, uint8_t len);
+int isl12022_snapshot(int i2cfd, struct isl12022_snap *snap);
+
+int isl12022_temp_mc(const struct isl12022_snap *snap);
+int isl12022_emulated(const struct isl12022_snap *snap);
+long isl12022_offset_ppb(const struct isl12022_snap *snap);
+/* Reads the time of day in seconds, or returns -1 */
+int isl12022_read_sod(int i2cfd);
+/* Decodes a timestamp, the year is always taken as this one */
+void isl12022_timestamp(const struct isl12022_snap *snap, uint8_t reg, struct tm *ts);
+
+#endif
@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lathist.h"
+
+void lathist_init(struct lathist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+static int lathist_index(uint64_t ns)
+{
+	int msb;
+	int idx;
+
+	if (ns < LATHIST_SUB)
+		return ns;
+
+	/* 16 buckets per power of two above 16 */
+	msb = 63 - __builtin_clzll(ns);
+	idx = (msb - 3) * LATHIST_SUB + ((ns >> (msb - 4)) & (LATHIST_SUB - 1));
+
+	return idx < LATHIST_BUCKETS ? idx : LATHIST_BUCKETS - 1;
+}
+
+/* Upper bound of the values that land in a bucket */
+static uint64_t lathist_value(int idx)
+{
+	int msb;
+
+	if (idx < LATHIST_SUB)
+		return idx;
+
+	msb = idx / LATHIST_SUB + 3;
+	return ((uint64_t)(LATHIST_SUB + idx % LATHIST_SUB + 1) << (msb - 4)) - 1;
+}
+
+void lathist_add(struct lathist *h, uint64_t ns)
+{
+	h->buckets[lathist_index(ns)]++;
+	h->count++;
+	h->sum += ns;
+	if (ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/* pct is 0-100, returns 0 if nothing was recorded */
+uint64_t lathist_percentile(const struct lathist *h, double pct)
+{
+	uint64_t want, seen = 0;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+
+	want = (uint64_t)(h->count * pct / 100.0 + 0.5);
+	if (want < 1)
+		want = 1;
+
+	for (i = 0; i < LATHIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want) {
+			uint64_t val = lathist_value(i);
+			return val > h->max ? h->max : val;
+		}
+	}
+
+	return h->max;
+}
@@ -0,0 +1,26 @@
+#ifndef __LATHIST_H_
+#define __LATHIST_H_
+
+#include <stdint.h>
+
+/*
+ * Latency histogram with log-linear buckets: each power of two is split in
+ * to 16 buckets, so any value is recorded to within about 6% in constant
+ * memory and constant time.  Values are in ns.
+ */
+#define LATHIST_SUB 16
+#define LATHIST_BUCKETS (LATHIST_SUB * 40)
+
+struct lathist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[LATHIST_BUCKETS];
+};
+
+void lathist_init(struct lathist *h);
+void lathist_add(struct lathist *h, uint64_t ns);
+uint64_t lathist_percentile(const struct lathist *h, double pct);
+
+#endif
@@ -9,16 +9,20 @@
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
+#include "i2cbus.h"
+
 int micro_init(int i2cbus, int i2caddr)
 {
 	static int fd = -1;
-	char i2c_bus_path[20];
 
 	if (fd != -1)
 		return fd;
 
-	snprintf(i2c_bus_path, sizeof(i2c_bus_path), "/dev/i2c-%d", i2cbus);
-	fd = open(i2c_bus_path, O_RDWR);
+	fd = i2cbus_connect(i2cbus);
+	if (fd != -1)
+		return fd;
+
+	fd = i2cbus_open(i2cbus);
 	if (fd < 0) {
 		perror("Couldn't open i2c device");
 		goto out;
@@ -28,7 +32,7 @@ int micro_init(int i2cbus, int i2caddr)
 	 * We use force because there is typically a driver attached. This is
 	 * safe because we are using only i2c_msgs and not read()/write() calls
 	 */
-	if (ioctl(fd, I2C_SLAVE_FORCE, i2caddr) < 0) {
+	if (i2cbus_set_slave(fd, i2caddr) < 0) {
 		perror("Supervisor did not ACK");
 		close(fd);
 		fd = -1;
@@ -44,7 +48,6 @@ out:
  */
 int speekstream16(int i2cfd, uint16_t i2caddr, uint16_t addr, uint16_t *data, uint16_t size)
 {
-	struct i2c_rdwr_ioctl_data packets;
 	struct i2c_msg msgs[2];
 	int ret;
 
@@ -58,14 +61,11 @@ int speekstream16(int i2cfd, uint16_t i2caddr, uint16_t addr, uint16_t *data, ui
 	msgs[1].len = size;
 	msgs[1].buf = (uint8_t *)data;
 
-	packets.msgs = msgs;
-	packets.nmsgs = 2;
-
 	/* I2C_RDWR will return < 0 on error, or the number of messages that
 	 * were transferred. We should always have two since we are only ever
 	 * sending a write followed by a read.
 	 */
-	ret = ioctl(i2cfd, I2C_RDWR, &packets);
+	ret = i2cbus_transfer(i2cfd, msgs, 2);
 	if (ret < 0)
 		perror("Unable to read data");
 	else if (ret == 2)
@@ -81,7 +81,6 @@ int speekstream16(int i2cfd, uint16_t i2caddr, uint16_t addr, uint16_t *data, ui
  */
 int spokestream16(int i2cfd, uint16_t i2caddr, uint16_t addr, uint16_t *data, uint16_t size)
 {
-	struct i2c_rdwr_ioctl_data packets;
 	struct i2c_msg msg;
 	uint8_t *outdata;
 	int ret;
@@ -101,10 +100,7 @@ int spokestream16(int i2cfd, uint16_t i2caddr, uint16_t addr, uint16_t *data, ui
 	msg.len = 2 + size;
 	msg.buf = outdata;
 
-	packets.msgs = &msg;
-	packets.nmsgs = 1;
-
-	ret = ioctl(i2cfd, I2C_RDWR, &packets);
+	ret = i2cbus_transfer(i2cfd, &msg, 1);
 	free(outdata);
 
 	/* I2C_RDWR will return < 0 on error, or the number of messages that
@@ -145,7 +141,6 @@ int speek16(int i2cfd, uint16_t i2caddr, uint16_t addr, uint16_t *data)
  */
 static int __v0_stream(int twifd, uint16_t i2caddr, uint8_t *data, uint16_t bytes, uint16_t flags)
 {
-	struct i2c_rdwr_ioctl_data packets;
 	struct i2c_msg msg;
 	int ret = 0;
 
@@ -154,14 +149,11 @@ static int __v0_stream(int twifd, uint16_t i2caddr, uint8_t *data, uint16_t byte
 	msg.len = bytes;
 	msg.buf = data;
 
-	packets.msgs = &msg;
-	packets.nmsgs = 1;
-
 	/* I2C_RDWR will return < 0 on error, or the number of messages that
 	 * were transferred. We should always have one since we are only ever
 	 * sending a single transfer.
 	 */
-	ret = ioctl(twifd, I2C_RDWR, &packets);
+	ret = i2cbus_transfer(twifd, &msg, 1);
 	if (ret < 0)
 		perror("Unable to transfer data");
 	else if (ret == 1)
@@ -181,3 +173,71 @@ int v0_stream_write(int twifd, uint16_t i2caddr, uint8_t *data, uint16_t bytes)
 {
 	return __v0_stream(twifd, i2caddr, data, bytes, 0);
 }
+
+/* Microcontroller revisions, only valid for the boot they were read in */
+#define MICRO_REV_CACHE "/run/ts4900-utils-microrev"
+
+/*
+ * Returns the MICROREV the microcontroller reports, or < 0 on failure.
+ *
+ * This is read once per boot and kept in MICRO_REV_CACHE by model, so
+ * callers that only want a channel or two do not have to read a whole
+ * frame first to find out how to read them.
+ */
+int micro_get_rev(int i2cfd, uint16_t i2caddr, int model)
+{
+	static int rev = -1;
+	char key[16];
+	uint8_t frame[32];
+	int cache;
+
+	if (rev >= 0)
+		return rev;
+
+	cache = !i2cbus_simulated();
+	snprintf(key, sizeof(key), "%x", model);
+	if (cache) {
+		rev = i2cbus_cache_get(MICRO_REV_CACHE, key);
+		if (rev >= 0)
+			return rev;
+	}
+
+	if (v0_stream_read(i2cfd, i2caddr, frame, sizeof(frame)) < 0)
+		return -1;
+	/* The TS-7970 has it as the last 16 bit channel, the TS-7990 only in
+	 * the last byte */
+	if (model == 0x7970)
+		rev = (frame[30] << 8) | frame[31];
+	else
+		rev = frame[31];
+
+	if (cache)
+		i2cbus_cache_put(MICRO_REV_CACHE, key, rev);
+
+	return rev;
+}
+
+/*
+ * Nonzero if the microcontroller takes a register address before a read,
+ * so a read can start anywhere in the frame.  That came with the Renesas
+ * parts on the TS-7970, rev 6.  Older parts and the TS-7990 always read
+ * from the start.
+ */
+int micro_addressed(int model, int rev)
+{
+	return model == 0x7970 && rev >= 6;
+}
+
+/*
+ * Reads bytes of the frame starting at byte off, in one transaction.  Only
+ * off 0 works unless addressed.  Returns < 0 on failure, 0 on success.
+ */
+int micro_read(int i2cfd, uint16_t i2caddr, int addressed, uint16_t off, uint8_t *data, uint16_t bytes)
+{
+	if (off == 0)
+		return v0_stream_read(i2cfd, i2caddr, data, bytes);
+	if (!addressed)
+		return -1;
+
+	return speekstream16(i2cfd, i2caddr, off, (uint16_t *)data, bytes);
+}
@@ -7,3 +7,8 @@ int spoke16(int i2cfd, uint16_t i2caddr, uint16_t addr, uint16_t data);
 int speek16(int i2cfd, uint16_t i2caddr, uint16_t addr, uint16_t *data);
 int v0_stream_write(int i2cfd, uint16_t i2caddr, uint8_t *data, uint16_t bytes);
 int v0_stream_read(int i2cfd, uint16_t i2caddr, uint8_t *data, uint16_t bytes);
+
+
+int micro_get_rev(int i2cfd, uint16_t i2caddr, int model);
+int micro_addressed(int model, int rev);
+int micro_read(int i2cfd, uint16_t i2caddr, int addressed, uint16_t off, uint8_t *data, uint16_t bytes);
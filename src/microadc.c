@@ -0,0 +1,129 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "microadc.h"
+
+static const struct micro_adc_model models[] = {
+	{
+		.model = 0x7970,
+		.nchans = 15,
+		.chans = {
+			{ "VDD_ARM_CAP", MICRO_ADC_MV },
+			{ "VDD_HIGH_CAP", MICRO_ADC_MV },
+			{ "VDD_SOC_CAP", MICRO_ADC_MV },
+			{ "VDD_ARM", MICRO_ADC_MV },
+			{ "P10_UA", MICRO_ADC_UA },
+			{ "P11_UA", MICRO_ADC_UA },
+			{ "P12_UA", MICRO_ADC_UA },
+			{ "VIN", MICRO_ADC_MV },
+			{ "V5_A", MICRO_ADC_MV },
+			{ "V3P1", MICRO_ADC_MV },
+			{ "DDR_1P5V", MICRO_ADC_MV },
+			{ "V1P8", MICRO_ADC_MV },
+			{ "V1P2", MICRO_ADC_MV },
+			{ "RAM_VREF", MICRO_ADC_MV },
+			{ "V3P3", MICRO_ADC_MV },
+		},
+		.gain = {
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_LOOP(110),
+			MICRO_ADC_LOOP(110),
+			MICRO_ADC_LOOP(110),
+			MICRO_ADC_DIV(2870, 147),
+			MICRO_ADC_DIV(147, 107),
+			MICRO_ADC_DIV(499, 499),
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIV(499, 499),
+		},
+	},
+	{
+		.model = 0x7990,
+		.nchans = 10,
+		.chans = {
+			{ "VIN", MICRO_ADC_MV },
+			{ "V5_A", MICRO_ADC_MV },
+			{ "AN_LCD_20V", MICRO_ADC_MV },
+			{ "DDR_1P5V", MICRO_ADC_MV },
+			{ "V1P8", MICRO_ADC_MV },
+			{ "SUPERCAP", MICRO_ADC_MV },
+			{ "BACK_LT_RAW", MICRO_ADC_MV, 1 },
+			{ "V3P3", MICRO_ADC_MV },
+			{ "VDD_ARM_CAP", MICRO_ADC_MV },
+			{ "VDD_SOC_CAP", MICRO_ADC_MV },
+		},
+		.gain = {
+			MICRO_ADC_DIV(2870, 147),
+			MICRO_ADC_DIV(147, 107),
+			MICRO_ADC_DIV(121, 1),
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIV(100, 22),
+			MICRO_ADC_DIV(2870, 147),
+			MICRO_ADC_DIV(499, 499),
+			MICRO_ADC_DIRECT,
+			MICRO_ADC_DIRECT,
+		},
+	},
+};
+
+const struct micro_adc_model *micro_adc_get_model(int model)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+		if (models[i].model == model)
+			return &models[i];
+	}
+
+	return NULL;
+}
+
+int micro_adc_find(const struct micro_adc_model *m, const char *name, int len)
+{
+	int i;
+
+	for (i = 0; i < m->nchans; i++) {
+		if (strlen(m->chans[i].name) == (size_t)len && strncmp(m->chans[i].name, name, len) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Every frame converts all MICRO_ADC_CHANS slots, unused slots have a zero
+ * gain.  The fixed trip count and the restrict pointers let the compiler
+ * vectorize the inner loop (NEON on the ARM boards) without intrinsics.
+ */
+void micro_adc_convert(const struct micro_adc_model *m, const uint8_t *frames, int stride, int nframes,
+		       uint32_t *out)
+{
+	uint32_t gain[MICRO_ADC_CHANS];
+	int32_t bias[MICRO_ADC_CHANS];
+	int f, c;
+
+	for (c = 0; c < MICRO_ADC_CHANS; c++) {
+		gain[c] = m->gain[c];
+		bias[c] = m->bias[c] + (1 << (MICRO_ADC_SHIFT - 1));
+	}
+
+	for (f = 0; f < nframes; f++) {
+		const uint8_t *__restrict p = frames + (size_t)f * stride;
+		uint32_t *__restrict o = out + (size_t)f * MICRO_ADC_CHANS;
+
+		for (c = 0; c < MICRO_ADC_CHANS; c++) {
+			uint32_t raw = (uint32_t)p[c * 2] << 8 | p[c * 2 + 1];
+			int32_t v = (int32_t)(raw * gain[c]) + bias[c];
+
+			/* A calibrated offset can take a reading near 0 below it */
+			o[c] = v < 0 ? 0 : v >> MICRO_ADC_SHIFT;
+		}
+	}
+}
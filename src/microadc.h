@@ -0,0 +1,106 @@
+#ifndef __MICROADC_H_
+#define __MICROADC_H_
+
+#include <stdint.h>
+
+/*
+ * Scaling for the supervisory microcontroller ADC channels.  The v0 frame
+ * read from the microcontroller starts with one big endian 16 bit sample per
+ * channel, 10 bits full scale at 2.5V.
+ *
+ * Each channel has a fixed point gain in units of 2^-MICRO_ADC_SHIFT that
+ * takes the raw sample straight to mV (or uA for current loops), so a whole
+ * frame converts with one multiply, add and shift per channel.  With a 12 bit
+ * shift the largest gain (the 121:1 divider) times a full scale sample still
+ * fits in 32 bits, and rounding the gain costs at most 0.125 mV.
+ *
+ * A board calibration (see microcal.h) replaces the nominal gains and adds
+ * an offset, in the same units, before the shift, so calibrated values cost
+ * no more to convert than nominal ones.
+ */
+#define MICRO_ADC_CHANS 16
+#define MICRO_ADC_SHIFT 12
+#define MICRO_ADC_FULL_MV 2500.0
+#define MICRO_ADC_FULL_RAW 1023.0
+
+/* Gain for a voltage through a resistor divider, r1 = 0 for a direct input */
+#define MICRO_ADC_DIV(r1, r2)                                                                             \
+	((uint32_t)(MICRO_ADC_FULL_MV * ((r1) + (r2)) / (MICRO_ADC_FULL_RAW * (r2)) * (1 << MICRO_ADC_SHIFT) + \
+		    0.5))
+#define MICRO_ADC_DIRECT MICRO_ADC_DIV(0, 1)
+/* Gain in uA for a 0-20mA current loop across shunt ohms */
+#define MICRO_ADC_LOOP(shunt) \
+	((uint32_t)(MICRO_ADC_FULL_MV * 1000 / (MICRO_ADC_FULL_RAW * (shunt)) * (1 << MICRO_ADC_SHIFT) + 0.5))
+
+enum micro_adc_unit {
+	MICRO_ADC_NONE = 0, /* Not a measurement, converts to 0 */
+	MICRO_ADC_MV,
+	MICRO_ADC_UA,
+};
+
+struct micro_adc_chan {
+	const char *name;
+	enum micro_adc_unit unit;
+	int hex; /* tsmicroctl --info prints it in hex */
+};
+
+struct micro_adc_model {
+	int model;
+	int nchans;
+	struct micro_adc_chan chans[MICRO_ADC_CHANS];
+	uint32_t gain[MICRO_ADC_CHANS];
+	int32_t bias[MICRO_ADC_CHANS]; /* Offset in units of 2^-MICRO_ADC_SHIFT, 0 unless calibrated */
+};
+
+/* TS-7990 supercap channel and the voltage reported as 100% */
+#define TS7990_VIN_CHAN 0
+#define TS7990_SUPERCAP_CHAN 5
+#define TS7990_SUPERCAP_FULL_MV 12000
+
+const struct micro_adc_model *micro_adc_get_model(int model);
+/* Index of the channel called the first len bytes of name, or -1 */
+int micro_adc_find(const struct micro_adc_model *m, const char *name, int len);
+
+/*
+ * Converts nframes raw v0 frames, each stride bytes apart, to
+ * MICRO_ADC_CHANS values per frame in out.  stride lets this run directly
+ * over buffered stream records.
+ */
+void micro_adc_convert(const struct micro_adc_model *m, const uint8_t *frames, int stride, int nframes,
+		       uint32_t *out);
+
+/* Sample for channel chan from the start of a v0 frame */
+static inline uint16_t micro_adc_raw(const uint8_t *frame, int chan)
+{
+	return (frame[chan * 2] << 8) | frame[chan * 2 + 1];
+}
+
+static inline int micro_adc_scale(uint16_t raw, uint32_t gain)
+{
+	return ((uint32_t)raw * gain + (1 << (MICRO_ADC_SHIFT - 1))) >> MICRO_ADC_SHIFT;
+}
+
+/* One channel the way micro_adc_convert() does it, offset included */
+static inline int micro_adc_value(const struct micro_adc_model *m, int chan, uint16_t raw)
+{
+	int32_t v = (int32_t)(raw * m->gain[chan]) + m->bias[chan] + (1 << (MICRO_ADC_SHIFT - 1));
+
+	return v < 0 ? 0 : v >> MICRO_ADC_SHIFT;
+}
+
+static inline int ts7990_vin_mv(uint16_t raw)
+{
+	return micro_adc_scale(raw, MICRO_ADC_DIV(2870, 147));
+}
+
+static inline int ts7990_supercap_mv(uint16_t raw)
+{
+	return micro_adc_scale(raw, MICRO_ADC_DIV(100, 22));
+}
+
+static inline int ts7990_supercap_pct(uint16_t raw)
+{
+	return (ts7990_supercap_mv(raw) * 100) / TS7990_SUPERCAP_FULL_MV;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "microcal.h"
+
+const char *microcal_path(void)
+{
+	const char *env = getenv("TS_MICRO_CAL");
+
+	return env && *env ? env : MICROCAL_FILE;
+}
+
+static void cal_init(struct microcal *cal, int model)
+{
+	memset(cal, 0, sizeof(*cal));
+	memcpy(cal->magic, MICROCAL_MAGIC, 4);
+	cal->version = MICROCAL_VERSION;
+	cal->model = model;
+}
+
+int microcal_load(struct microcal *cal, int model)
+{
+	const char *path = microcal_path();
+	FILE *f;
+	int n;
+
+	cal_init(cal, model);
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		if (errno != ENOENT)
+			perror(path);
+		return -1;
+	}
+	n = fread(cal, 1, sizeof(*cal), f);
+	fclose(f);
+
+	if (n != sizeof(*cal) || memcmp(cal->magic, MICROCAL_MAGIC, 4) != 0 || cal->version != MICROCAL_VERSION) {
+		fprintf(stderr, "%s: not a calibration file, ignored\n", path);
+		cal_init(cal, model);
+		return -1;
+	}
+	if (cal->model != model) {
+		fprintf(stderr, "%s: calibration is for a TS-%X, ignored\n", path, cal->model);
+		cal_init(cal, model);
+		return -1;
+	}
+
+	return 0;
+}
+
+int microcal_save(const struct microcal *cal)
+{
+	const char *path = microcal_path();
+	char tmp[4096];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		perror(tmp);
+		return -1;
+	}
+	if (fwrite(cal, sizeof(*cal), 1, f) != 1 || fflush(f) != 0 || fsync(fileno(f)) != 0) {
+		perror(tmp);
+		fclose(f);
+		unlink(tmp);
+		return -1;
+	}
+	if (fclose(f) != 0 || rename(tmp, path) != 0) {
+		perror(path);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint32_t raw_span(uint32_t a, uint32_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+int microcal_add_point(struct microcal *cal, const struct micro_adc_model *nominal, int chan, uint32_t raw_q8,
+		       int32_t ref)
+{
+	struct microcal_chan *c = &cal->chan[chan];
+	int64_t dref = 0, draw = 1, bias;
+	uint64_t gain;
+	int i;
+
+	if (nominal->chans[chan].hex) {
+		fprintf(stderr, "%s is not a measurement\n", nominal->chans[chan].name);
+		return -1;
+	}
+	if (ref < 0) {
+		fprintf(stderr, "%s: the reference cannot be negative\n", nominal->chans[chan].name);
+		return -1;
+	}
+	if (raw_q8 < 256) {
+		fprintf(stderr, "%s reads 0, nothing to calibrate against\n", nominal->chans[chan].name);
+		return -1;
+	}
+
+	/* A new point replaces the stored one nearest it, so re-measuring a
+	 * point refreshes it and the other is kept for the offset.  Two
+	 * points closer than MICROCAL_MIN_SPAN give no offset, so the new one
+	 * stands alone then. */
+	if (c->npoints == 2)
+		i = raw_span(c->raw_q8[0], raw_q8) <= raw_span(c->raw_q8[1], raw_q8) ? 0 : 1;
+	else
+		i = c->npoints;
+	c->raw_q8[i] = raw_q8;
+	c->ref[i] = ref;
+	if (i == c->npoints)
+		c->npoints++;
+	if (c->npoints == 2 && raw_span(c->raw_q8[0], c->raw_q8[1]) < MICROCAL_MIN_SPAN * 256) {
+		c->raw_q8[0] = raw_q8;
+		c->ref[0] = ref;
+		c->npoints = 1;
+	}
+
+	if (c->npoints == 2) {
+		dref = (int64_t)c->ref[1] - c->ref[0];
+		draw = (int64_t)c->raw_q8[1] - c->raw_q8[0];
+		if ((dref <= 0) != (draw < 0)) {
+			fprintf(stderr, "%s: the points go the wrong way, starting again from this one\n",
+				nominal->chans[chan].name);
+			c->raw_q8[0] = raw_q8;
+			c->ref[0] = ref;
+			c->npoints = 1;
+		}
+	}
+
+	if (c->npoints == 1) {
+		gain = (((uint64_t)ref << (MICRO_ADC_SHIFT + 8)) + raw_q8 / 2) / raw_q8;
+		bias = 0;
+	} else {
+		gain = (dref * (1 << (MICRO_ADC_SHIFT + 8)) + draw / 2) / draw;
+		bias = ((int64_t)c->ref[1] << MICRO_ADC_SHIFT) - (int64_t)(gain * c->raw_q8[1] >> 8);
+	}
+
+	/* The conversion is done in 32 bits */
+	if (gain == 0 || gain * 1023 + llabs(bias) + (1 << MICRO_ADC_SHIFT) > INT32_MAX) {
+		fprintf(stderr, "%s: calibration out of range\n", nominal->chans[chan].name);
+		c->npoints = 0;
+		return -1;
+	}
+	c->gain = gain;
+	c->bias = bias;
+
+	return 0;
+}
+
+const struct micro_adc_model *microcal_get_model(int model)
+{
+	static struct micro_adc_model calibrated;
+	static int loaded;
+	const struct micro_adc_model *nominal = micro_adc_get_model(model);
+	struct microcal cal;
+	int c;
+
+	if (nominal == NULL)
+		return NULL;
+	if (loaded)
+		return loaded > 0 && calibrated.model == model ? &calibrated : nominal;
+
+	loaded = -1;
+	if (microcal_load(&cal, model) < 0)
+		return nominal;
+
+	calibrated = *nominal;
+	for (c = 0; c < nominal->nchans; c++) {
+		if (cal.chan[c].npoints == 0 || nominal->chans[c].hex)
+			continue;
+		calibrated.gain[c] = cal.chan[c].gain;
+		calibrated.bias[c] = cal.chan[c].bias;
+	}
+	loaded = 1;
+
+	return &calibrated;
+}
@@ -0,0 +1,55 @@
+#ifndef __MICROCAL_H_
+#define __MICROCAL_H_
+
+#include <stdint.h>
+
+#include "microadc.h"
+
+/*
+ * Per-board calibration of the microcontroller ADC channels
+ *
+ * "tsmicroctl --calibrate CHAN=value" averages many frames while a known
+ * value is applied to a channel and records the point.  One point corrects
+ * the gain through zero, and a second point far enough from the first
+ * corrects gain and offset both.  Two points are kept for each channel, a
+ * new one replacing the one nearest it, so calibrating again only ever
+ * refines it.
+ *
+ * The file is small and binary, in host byte order, at MICROCAL_FILE or
+ * wherever TS_MICRO_CAL points.  The gain and offset are turned into the
+ * fixed point gain and bias micro_adc_convert() already applies.
+ */
+#define MICROCAL_FILE "/etc/tsmicroctl.cal"
+#define MICROCAL_MAGIC "TSCL"
+#define MICROCAL_VERSION 1
+#define MICROCAL_MIN_SPAN 64 /* Codes between two points for an offset */
+#define MICROCAL_FRAMES 256 /* Frames averaged for a point by default */
+
+struct microcal_chan {
+	uint32_t npoints;
+	uint32_t raw_q8[2]; /* Mean code in 1/256ths */
+	int32_t ref[2]; /* The value in mV or uA it should read as */
+	uint32_t gain;
+	int32_t bias;
+};
+
+struct microcal {
+	char magic[4];
+	uint16_t version;
+	uint16_t model;
+	struct microcal_chan chan[MICRO_ADC_CHANS];
+};
+
+const char *microcal_path(void);
+/* Returns 0, or -1 if there is no calibration for model.  A file that does
+ * not parse is reported. */
+int microcal_load(struct microcal *cal, int model);
+int microcal_save(const struct microcal *cal);
+/* Adds a point for chan to cal, returns 0 or -1 with a message */
+int microcal_add_point(struct microcal *cal, const struct micro_adc_model *nominal, int chan, uint32_t raw_q8,
+		       int32_t ref);
+/* The channel table for model with this board's calibration applied, or
+ * the nominal one if there is none */
+const struct micro_adc_model *microcal_get_model(int model);
+
+#endif
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "microcic.h"
+
+int microcic_init(struct microcic *c, int order, int ratio)
+{
+	int bits = 0, i;
+
+	memset(c, 0, sizeof(*c));
+	if (order < 1 || order > MICROCIC_MAX_ORDER || ratio < 1) {
+		fprintf(stderr, "CIC order must be 1-%d and ratio at least 1\n", MICROCIC_MAX_ORDER);
+		return -1;
+	}
+	while (bits < 31 && (1u << bits) < (unsigned int)ratio)
+		bits++;
+	if (10 + order * bits > 64) {
+		fprintf(stderr, "CIC order %d ratio %d needs more than 64 bits\n", order, ratio);
+		return -1;
+	}
+
+	c->order = order;
+	c->ratio = ratio;
+	c->gain = 1;
+	for (i = 0; i < order; i++)
+		c->gain *= ratio;
+
+	return 0;
+}
+
+int microcic_add(struct microcic *c, const uint8_t *frame, uint64_t *out)
+{
+	int ch, k;
+
+	for (ch = 0; ch < MICRO_ADC_CHANS; ch++) {
+		uint64_t *integ = c->integ[ch];
+
+		integ[0] += micro_adc_raw(frame, ch);
+		for (k = 1; k < c->order; k++)
+			integ[k] += integ[k - 1];
+	}
+
+	if (++c->n < c->ratio)
+		return 0;
+	c->n = 0;
+
+	for (ch = 0; ch < MICRO_ADC_CHANS; ch++) {
+		uint64_t v = c->integ[ch][c->order - 1];
+
+		for (k = 0; k < c->order; k++) {
+			uint64_t y = v - c->comb[ch][k];
+
+			c->comb[ch][k] = v;
+			v = y;
+		}
+		out[ch] = v;
+	}
+
+	return ++c->outputs >= (uint64_t)c->order;
+}
@@ -0,0 +1,39 @@
+#ifndef __MICROCIC_H_
+#define __MICROCIC_H_
+
+#include <stdint.h>
+
+#include "microadc.h"
+
+/*
+ * Oversampling and decimation of the raw ADC codes with a CIC filter
+ *
+ * Each channel runs order integrators at the input rate and order combs at
+ * the output rate, one output for every ratio frames.  Order 1 is a plain
+ * average of each block of ratio frames, higher orders reject more of the
+ * noise above the output rate at the cost of a longer response.  Everything
+ * is integer: the state wraps modulo 2^64 and the outputs are exact as long
+ * as 10 + order * log2(ratio) bits fit, which microcic_init() checks.
+ * Outputs are the sum of the codes scaled by gain = ratio^order, so dividing
+ * by gain gives a code with the extra resolution averaging bought.
+ */
+#define MICROCIC_MAX_ORDER 4
+
+struct microcic {
+	int order;
+	int ratio;
+	int n; /* Frames since the last output */
+	uint64_t outputs;
+	uint64_t gain;
+	uint64_t integ[MICRO_ADC_CHANS][MICROCIC_MAX_ORDER];
+	uint64_t comb[MICRO_ADC_CHANS][MICROCIC_MAX_ORDER];
+};
+
+/* Returns 0, or -1 if the order or ratio are out of range */
+int microcic_init(struct microcic *c, int order, int ratio);
+/* Feeds one v0 frame, returns 1 and fills out with the filtered codes times
+ * c->gain once every ratio frames.  The first order - 1 outputs, while the
+ * filter fills, are not returned. */
+int microcic_add(struct microcic *c, const uint8_t *frame, uint64_t *out);
+
+#endif
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "microlog.h"
+
+/* Longest sample: the time, the mask and a 16 bit change for every channel */
+#define MAX_SAMPLE (10 + 3 + MICRO_ADC_CHANS * 3)
+
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+
+	return p;
+}
+
+/* Returns NULL if the varint runs past end */
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while (p < end && shift < 64) {
+		*v |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return p;
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+static int seg_open(struct microlog *l, int seg, int flags)
+{
+	char path[4096];
+
+	snprintf(path, sizeof(path), MICROLOG_SEG_NAME, l->dir, seg);
+	l->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0644);
+	if (l->fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void block_start(struct microlog *l)
+{
+	struct microlog_hdr *h = (struct microlog_hdr *)l->cur;
+
+	memset(l->cur, 0, sizeof(l->cur));
+	memcpy(h->magic, MICROLOG_MAGIC, 4);
+	h->version = MICROLOG_VERSION;
+	h->model = l->model;
+	h->nchans = l->nchans;
+	memset(l->prev, 0, sizeof(l->prev));
+}
+
+int microlog_open(struct microlog *l, const char *dir, int nsegs, int model, int nchans)
+{
+	const struct microlog_hdr *h = (const struct microlog_hdr *)l->cur;
+	struct stat st;
+	char path[4096];
+	int seg, fd, n, found = 0;
+
+	l->dir = dir;
+	l->nsegs = nsegs;
+	l->model = model;
+	l->nchans = nchans;
+	l->seg = 0;
+	l->block = 0;
+	l->seq = 0;
+	l->nqueued = 0;
+	l->written = 0;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror(dir);
+		return -1;
+	}
+
+	/* The ring carries on after the newest intact block.  A power loss
+	 * during a flush leaves torn blocks at the end of a segment, so each
+	 * one is searched back from its end. */
+	for (seg = 0; seg < nsegs; seg++) {
+		snprintf(path, sizeof(path), MICROLOG_SEG_NAME, dir, seg);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		n = fstat(fd, &st) == 0 ? st.st_size / MICROLOG_BLOCK : 0;
+		while (--n >= 0 && microlog_read_block(fd, n, l->cur) < 0)
+			;
+		if (n >= 0 && (!found || h->seq + 1 > l->seq)) {
+			found = 1;
+			l->seq = h->seq + 1;
+			l->seg = seg;
+			l->block = n + 1;
+		}
+		close(fd);
+	}
+
+	if (l->block >= MICROLOG_SEG_BLOCKS) {
+		l->seg = (l->seg + 1) % nsegs;
+		l->block = 0;
+	}
+	if (seg_open(l, l->seg, l->block == 0 ? O_TRUNC : 0) < 0)
+		return -1;
+	/* Drop whatever torn blocks follow, the rest of the segment is kept */
+	if (l->block && ftruncate(l->fd, (off_t)l->block * MICROLOG_BLOCK) < 0) {
+		perror("microlog truncate");
+		close(l->fd);
+		return -1;
+	}
+	block_start(l);
+
+	return 0;
+}
+
+/* Seals the block being filled and queues it */
+static void block_end(struct microlog *l)
+{
+	struct microlog_hdr *h = (struct microlog_hdr *)l->cur;
+
+	h->seq = l->seq++;
+	h->crc = 0;
+	h->crc = crc32(l->cur, MICROLOG_BLOCK);
+	memcpy(l->queue[l->nqueued++], l->cur, MICROLOG_BLOCK);
+	block_start(l);
+}
+
+int microlog_add(struct microlog *l, uint64_t ns, const uint8_t *frame)
+{
+	struct microlog_hdr *h = (struct microlog_hdr *)l->cur;
+	uint8_t *p;
+	uint64_t mask = 0;
+	uint16_t raw;
+	int32_t d;
+	int c;
+
+	if (h->used + MAX_SAMPLE > MICROLOG_PAYLOAD) {
+		block_end(l);
+		if (l->nqueued == MICROLOG_QUEUE && microlog_flush(l, 0) < 0)
+			return -1;
+	}
+
+	if (h->nsamples == 0) {
+		h->first_ns = ns;
+		l->prev_ns = ns;
+	}
+	/* Times are kept to the us, counted from the previous sample as a
+	 * reader will have rebuilt it so rounding does not add up */
+	p = put_varint(l->cur + sizeof(*h) + h->used, ns > l->prev_ns ? (ns - l->prev_ns) / 1000 : 0);
+	if (ns > l->prev_ns)
+		l->prev_ns += (ns - l->prev_ns) / 1000 * 1000;
+
+	for (c = 0; c < l->nchans; c++) {
+		if (micro_adc_raw(frame, c) != l->prev[c])
+			mask |= 1 << c;
+	}
+	p = put_varint(p, mask);
+	for (c = 0; c < l->nchans; c++) {
+		if (!(mask & (1 << c)))
+			continue;
+		raw = micro_adc_raw(frame, c);
+		d = (int32_t)raw - l->prev[c];
+		p = put_varint(p, ((uint32_t)d << 1) ^ (uint32_t)(d >> 31));
+		l->prev[c] = raw;
+	}
+
+	h->used = p - (l->cur + sizeof(*h));
+	h->nsamples++;
+	h->last_ns = l->prev_ns;
+
+	return 0;
+}
+
+static int block_write(struct microlog *l, const uint8_t *block)
+{
+	if (l->block == MICROLOG_SEG_BLOCKS) {
+		/* The ring moves on and the oldest segment goes */
+		fdatasync(l->fd);
+		close(l->fd);
+		l->seg = (l->seg + 1) % l->nsegs;
+		l->block = 0;
+		if (seg_open(l, l->seg, O_TRUNC) < 0)
+			return -1;
+	}
+
+	if (pwrite(l->fd, block, MICROLOG_BLOCK, (off_t)l->block * MICROLOG_BLOCK) != MICROLOG_BLOCK) {
+		perror("microlog write");
+		return -1;
+	}
+	l->block++;
+	l->written++;
+
+	return 0;
+}
+
+int microlog_flush(struct microlog *l, int partial)
+{
+	struct microlog_hdr *h = (struct microlog_hdr *)l->cur;
+	int i, ret = 0;
+
+	if (partial && h->nsamples)
+		block_end(l);
+
+	for (i = 0; i < l->nqueued && ret == 0; i++)
+		ret = block_write(l, l->queue[i]);
+	if (l->nqueued && fdatasync(l->fd) < 0) {
+		perror("microlog sync");
+		ret = -1;
+	}
+	l->nqueued = 0;
+
+	return ret;
+}
+
+int microlog_close(struct microlog *l)
+{
+	int ret = microlog_flush(l, 1);
+
+	close(l->fd);
+
+	return ret;
+}
+
+int microlog_read_block(int fd, int idx, uint8_t *block)
+{
+	struct microlog_hdr *h = (struct microlog_hdr *)block;
+	uint32_t crc;
+
+	if (pread(fd, block, MICROLOG_BLOCK, (off_t)idx * MICROLOG_BLOCK) != MICROLOG_BLOCK)
+		return -1;
+	if (memcmp(h->magic, MICROLOG_MAGIC, 4) != 0 || h->version != MICROLOG_VERSION ||
+	    h->used > MICROLOG_PAYLOAD || h->nchans > MICRO_ADC_CHANS)
+		return -1;
+
+	crc = h->crc;
+	h->crc = 0;
+	if (crc32(block, MICROLOG_BLOCK) != crc)
+		return -1;
+	h->crc = crc;
+
+	return 0;
+}
+
+void microlog_iter_init(struct microlog_iter *it, const uint8_t *block)
+{
+	const struct microlog_hdr *h = (const struct microlog_hdr *)block;
+
+	it->p = block + sizeof(*h);
+	it->end = it->p + h->used;
+	it->nchans = h->nchans;
+	it->ns = h->first_ns;
+	memset(it->raw, 0, sizeof(it->raw));
+}
+
+int microlog_iter_next(struct microlog_iter *it)
+{
+	uint64_t dt, mask, z;
+	int c;
+
+	if (it->p >= it->end)
+		return 0;
+
+	it->p = get_varint(it->p, it->end, &dt);
+	if (it->p)
+		it->p = get_varint(it->p, it->end, &mask);
+	if (it->p == NULL)
+		return 0;
+	it->ns += dt * 1000;
+
+	for (c = 0; c < it->nchans; c++) {
+		if (!(mask & (1 << c)))
+			continue;
+		it->p = get_varint(it->p, it->end, &z);
+		if (it->p == NULL)
+			return 0;
+		it->raw[c] += (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+	}
+
+	return 1;
+}
@@ -0,0 +1,96 @@
+#ifndef __MICROLOG_H_
+#define __MICROLOG_H_
+
+#include <stdint.h>
+
+#include "microadc.h"
+
+/*
+ * Compact on-flash log of raw ADC frames, written by "tsmicroctl --log" and
+ * read back with tsmicrolog.
+ *
+ * Samples are packed into MICROLOG_BLOCK byte blocks.  Each sample is the
+ * time since the previous one in us, a mask of the channels whose code
+ * changed and the change for each of those, all as varints (the changes
+ * zigzag encoded), so a steady rail costs nothing and a noisy one a byte.
+ * Full blocks are queued in memory and written out together every flush
+ * interval, each block in one write, and a block is never rewritten.
+ *
+ * The log is a directory of nsegs segment files of MICROLOG_SEG_BLOCKS
+ * blocks each, used as a ring: when the last one fills, the oldest is
+ * truncated and started again, so the log never takes more than
+ * nsegs * MICROLOG_SEG_BLOCKS * MICROLOG_BLOCK bytes.  Blocks carry a
+ * sequence number, a CRC and CLOCK_REALTIME timestamps so a reader can put
+ * them in order and skip any a power loss tore.
+ */
+#define MICROLOG_MAGIC "TSLB"
+#define MICROLOG_VERSION 1
+#define MICROLOG_BLOCK 4096
+#define MICROLOG_SEG_BLOCKS 256
+#define MICROLOG_SEGS 8
+#define MICROLOG_QUEUE 16 /* Full blocks held before a flush is forced */
+#define MICROLOG_FLUSH_S 60
+#define MICROLOG_SEG_NAME "%s/seg%03d.tsl"
+
+struct microlog_hdr {
+	char magic[4];
+	uint16_t version;
+	uint16_t model;
+	uint32_t crc; /* CRC-32 of the whole block with this field zero */
+	uint16_t used; /* Bytes of samples after the header */
+	uint16_t nchans;
+	uint32_t nsamples;
+	uint32_t pad;
+	uint64_t seq; /* Blocks written before this one */
+	uint64_t first_ns; /* CLOCK_REALTIME of the first and last sample */
+	uint64_t last_ns;
+};
+
+#define MICROLOG_PAYLOAD (MICROLOG_BLOCK - sizeof(struct microlog_hdr))
+
+struct microlog {
+	const char *dir;
+	int nsegs;
+	int model;
+	int nchans;
+	int seg; /* Segment and block the next block goes to */
+	int block;
+	int fd;
+	uint64_t seq;
+
+	/* The block being filled, and the previous sample in it */
+	uint8_t cur[MICROLOG_BLOCK];
+	uint64_t prev_ns;
+	uint16_t prev[MICRO_ADC_CHANS];
+
+	uint8_t queue[MICROLOG_QUEUE][MICROLOG_BLOCK];
+	int nqueued;
+	uint64_t written; /* Blocks written out */
+};
+
+/* Decodes the samples of one block in turn */
+struct microlog_iter {
+	const uint8_t *p;
+	const uint8_t *end;
+	int nchans;
+	uint64_t ns;
+	uint16_t raw[MICRO_ADC_CHANS];
+};
+
+/* Returns 0, or -1 with a message.  Carries on after the newest intact
+ * block already in dir, dropping any torn ones after it. */
+int microlog_open(struct microlog *l, const char *dir, int nsegs, int model, int nchans);
+/* Adds a sample taken at CLOCK_REALTIME ns, returns 0 or -1 on a write error */
+int microlog_add(struct microlog *l, uint64_t ns, const uint8_t *frame);
+/* Writes out the queued blocks, and the one being filled if partial */
+int microlog_flush(struct microlog *l, int partial);
+int microlog_close(struct microlog *l);
+
+/* Reads block idx of the open segment fd.  Returns 0, or -1 if there is no
+ * such block or it is not intact. */
+int microlog_read_block(int fd, int idx, uint8_t *block);
+void microlog_iter_init(struct microlog_iter *it, const uint8_t *block);
+/* Returns 1 with the next sample in it->ns and it->raw, or 0 at the end */
+int microlog_iter_next(struct microlog_iter *it);
+
+#endif
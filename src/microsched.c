@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "microsched.h"
+
+int microsched_parse(struct microsched *s, const struct micro_adc_model *adc, const char *list)
+{
+	const char *p = list;
+	char *end;
+	double hz;
+	int namelen, chan, i;
+
+	memset(s, 0, sizeof(*s));
+	s->adc = adc;
+
+	while (*p) {
+		end = strchr(p, '=');
+		if (end == NULL) {
+			fprintf(stderr, "%s: expected CHAN=hz\n", p);
+			return -1;
+		}
+		namelen = end - p;
+		chan = micro_adc_find(adc, p, namelen);
+		if (chan < 0) {
+			fprintf(stderr, "No channel %.*s on this model\n", namelen, p);
+			return -1;
+		}
+
+		hz = strtod(end + 1, &end);
+		if (hz <= 0 || hz > MICROSCHED_MAX_HZ || (*end != ',' && *end != 0)) {
+			fprintf(stderr, "%.*s: rate must be more than 0 and at most %d Hz\n", namelen, p,
+				MICROSCHED_MAX_HZ);
+			return -1;
+		}
+
+		for (i = 0; i < s->n && s->c[i].chan != chan; i++)
+			;
+		if (i == s->n)
+			s->n++;
+		s->c[i].chan = chan;
+		s->c[i].period_ns = 1e9 / hz;
+
+		p = *end ? end + 1 : end;
+	}
+
+	if (s->n == 0) {
+		fprintf(stderr, "No channels to schedule\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void microsched_start(struct microsched *s, uint64_t ns)
+{
+	int i;
+
+	for (i = 0; i < s->n; i++) {
+		s->c[i].next_ns = ns;
+		s->c[i].missed = 0;
+	}
+}
+
+uint64_t microsched_next(const struct microsched *s)
+{
+	uint64_t next = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < s->n; i++) {
+		if (s->c[i].next_ns < next)
+			next = s->c[i].next_ns;
+	}
+
+	return next;
+}
+
+int microsched_plan(const struct microsched *s, uint64_t ns, struct microsched_read *r)
+{
+	int i, first = MICRO_ADC_CHANS, last = -1;
+
+	r->off = 0;
+	r->len = 0;
+	r->mask = 0;
+	for (i = 0; i < s->n; i++) {
+		const struct microsched_chan *c = &s->c[i];
+
+		if (c->next_ns > ns)
+			continue;
+		r->mask |= 1 << c->chan;
+		if (c->chan < first)
+			first = c->chan;
+		if (c->chan > last)
+			last = c->chan;
+	}
+	if (last < 0)
+		return 0;
+
+	/* Anything due soon costs less here than in a read of its own */
+	for (i = 0; i < s->n; i++) {
+		const struct microsched_chan *c = &s->c[i];
+
+		if (c->next_ns <= ns + c->period_ns / MICROSCHED_EARLY) {
+			r->mask |= 1 << c->chan;
+			if (c->chan < first)
+				first = c->chan;
+			if (c->chan > last)
+				last = c->chan;
+		}
+	}
+	r->len = (last + 1) * 2;
+	if (s->addressed && first * 2 > MICROSCHED_ADDR_BYTES) {
+		r->off = first * 2;
+		r->len -= r->off;
+	}
+
+	return 1;
+}
+
+void microsched_done(struct microsched *s, const struct microsched_read *r, uint64_t ns)
+{
+	int i;
+
+	for (i = 0; i < s->n; i++) {
+		struct microsched_chan *c = &s->c[i];
+
+		if (!(r->mask & (1 << c->chan)))
+			continue;
+		/* Stay on the original grid so rates do not drift, counting
+		 * any deadlines that went by.  One read early starts a new grid
+		 * so it cannot run ahead. */
+		if (c->next_ns > ns)
+			c->next_ns = ns;
+		c->next_ns += c->period_ns;
+		while (c->next_ns <= ns) {
+			c->next_ns += c->period_ns;
+			c->missed++;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef __MICROSCHED_H_
+#define __MICROSCHED_H_
+
+#include <stdint.h>
+
+#include "microadc.h"
+
+/*
+ * Reads ADC channels at their own rates, written as a list like
+ *
+ *	SUPERCAP=50,VIN=50,V1P2=0.1,RAM_VREF=0.1
+ *
+ * in Hz.  Each read is the shortest frame prefix that holds every channel
+ * due, and any channel due within a quarter of its period is brought
+ * forward into it rather than costing a read of its own shortly after.
+ * Other channels the prefix happens to cover keep their own schedule.
+ *
+ * When the microcontroller takes register addresses the read can start at
+ * the first channel due instead, if skipping the channels before it saves
+ * more than sending the address costs.
+ * Channels are never read late on purpose, a deadline is only missed when
+ * the bus or the scheduler could not keep up.
+ */
+#define MICROSCHED_MAX_HZ 1000
+#define MICROSCHED_EARLY 4 /* Brought forward if due within period / EARLY */
+#define MICROSCHED_ADDR_BYTES 3 /* Register address write, address byte and offset */
+
+struct microsched_chan {
+	int chan;
+	uint64_t period_ns;
+	uint64_t next_ns; /* Deadline for the next read */
+	uint64_t missed; /* Deadlines passed without a read */
+};
+
+struct microsched {
+	const struct micro_adc_model *adc;
+	int addressed; /* Reads can start anywhere, see micro_addressed() */
+	int n;
+	struct microsched_chan c[MICRO_ADC_CHANS];
+};
+
+/* One planned read */
+struct microsched_read {
+	uint16_t off; /* Where in the frame to start, 0 unless addressed */
+	uint16_t len; /* Bytes to read */
+	uint16_t mask; /* Scheduled channels the read serves */
+};
+
+/* Returns 0, or -1 with a message if list does not parse for this model */
+int microsched_parse(struct microsched *s, const struct micro_adc_model *adc, const char *list);
+/* Makes every channel due at ns */
+void microsched_start(struct microsched *s, uint64_t ns);
+/* Earliest deadline of any channel */
+uint64_t microsched_next(const struct microsched *s);
+/* Plans the read for time ns.  Returns 0 if nothing is due yet. */
+int microsched_plan(const struct microsched *s, uint64_t ns, struct microsched_read *r);
+/* Moves the deadlines of the channels r served on past ns */
+void microsched_done(struct microsched *s, const struct microsched_read *r, uint64_t ns);
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef __MICROSHM_H_
+#define __MICROSHM_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "microadc.h"
+#include "seqlock.h"
+
+/*
+ * ADC telemetry published by "tsmicroctl --publish".  One sampler reads
+ * the microcontroller and writes each decoded frame, plus the last
+ * MICROSHM_HISTORY of them, to shared memory under the seqlock.  Any number
+ * of readers can then take consistent snapshots with no syscalls and no
+ * I2C traffic.  Everything a reader needs is in this header, and it builds
+ * as C or C++.
+ *
+ * Timestamps are CLOCK_MONOTONIC in ns.  Values are in mV, or uA for the
+ * channels whose unit is MICRO_ADC_UA.
+ *
+ * The sampler also keeps rolling statistics for each channel over up to
+ * MICROSHM_WINDOWS windows (1 s, 1 min and 1 h unless configured), which it
+ * refreshes here every MICROSHM_STATS_MS.
+ */
+#define MICROSHM_NAME "/tsmicroctl"
+#define MICROSHM_MAGIC 0x54534d41
+#define MICROSHM_HISTORY 64
+#define MICROSHM_NAME_LEN 16
+#define MICROSHM_FRAME 32
+#define MICROSHM_WINDOWS 4
+#define MICROSHM_STATS_MS 100
+
+struct microshm_sample {
+	uint64_t ns;
+	uint64_t seq; /* Samples taken before this one */
+	uint32_t val[MICRO_ADC_CHANS];
+	uint8_t frame[MICROSHM_FRAME]; /* Raw v0 frame */
+};
+
+struct microshm_stat {
+	int32_t min;
+	int32_t max;
+	int32_t p1; /* Approximate 1st and 99th percentiles */
+	int32_t p99;
+	float mean;
+	float stddev;
+};
+
+struct microshm_window {
+	uint32_t seconds;
+	uint32_t pad;
+	uint64_t n; /* Samples in the window */
+	uint64_t ns; /* When these were computed */
+	struct microshm_stat stat[MICRO_ADC_CHANS];
+};
+
+struct microshm {
+	uint32_t magic;
+	uint32_t lock;
+	int32_t model;
+	uint32_t period_ns;
+	uint32_t nchans;
+	uint8_t unit[MICRO_ADC_CHANS];
+	char name[MICRO_ADC_CHANS][MICROSHM_NAME_LEN];
+	uint64_t count; /* Samples published, the latest is hist[(count - 1) % MICROSHM_HISTORY] */
+	struct microshm_sample hist[MICROSHM_HISTORY];
+	uint32_t nwindows;
+	struct microshm_window win[MICROSHM_WINDOWS];
+};
+
+/* Returns the mapped segment, or NULL if no sampler is running */
+static inline const struct microshm *microshm_map(void)
+{
+	const struct microshm *shm;
+	void *p;
+	int fd;
+
+	fd = shm_open(MICROSHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	p = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	shm = (const struct microshm *)p;
+	if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != MICROSHM_MAGIC) {
+		munmap(p, sizeof(*shm));
+		return NULL;
+	}
+
+	return shm;
+}
+
+/* Channel index for name, or -1 */
+static inline int microshm_find(const struct microshm *shm, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < shm->nchans && i < MICRO_ADC_CHANS; i++) {
+		if (strncmp(shm->name[i], name, MICROSHM_NAME_LEN) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/* Copies the latest sample.  Returns 0, or -1 if there is none newer than
+ * maxage_ns or the sampler died in the middle of an update */
+static inline int microshm_latest(const struct microshm *shm, struct microshm_sample *s, uint64_t maxage_ns)
+{
+	struct timespec ts;
+	uint64_t count, now;
+	uint32_t seq;
+
+	do {
+		if (seqlock_read_begin(&shm->lock, &seq) < 0)
+			return -1;
+		count = shm->count;
+		if (count)
+			*s = shm->hist[(count - 1) % MICROSHM_HISTORY];
+	} while (seqlock_read_retry(&shm->lock, seq));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	if (count == 0 || now - s->ns > maxage_ns)
+		return -1;
+
+	return 0;
+}
+
+/* Copies up to n of the most recent samples, oldest first.  Returns how
+ * many were copied. */
+static inline int microshm_history(const struct microshm *shm, struct microshm_sample *s, int n)
+{
+	uint64_t count, first;
+	uint32_t seq;
+	int i;
+
+	if (n > MICROSHM_HISTORY)
+		n = MICROSHM_HISTORY;
+
+	do {
+		if (seqlock_read_begin(&shm->lock, &seq) < 0)
+			return 0;
+		count = shm->count;
+		if ((uint64_t)n > count)
+			n = count;
+		first = count - n;
+		for (i = 0; i < n; i++)
+			s[i] = shm->hist[(first + i) % MICROSHM_HISTORY];
+	} while (seqlock_read_retry(&shm->lock, seq));
+
+	return n;
+}
+
+/* Copies the statistics for window, 0 to nwindows - 1.  Returns 0, or -1
+ * if there is no such window */
+static inline int microshm_stats(const struct microshm *shm, int window, struct microshm_window *w)
+{
+	uint32_t seq;
+	int ret;
+
+	do {
+		if (seqlock_read_begin(&shm->lock, &seq) < 0)
+			return -1;
+		ret = window >= 0 && (uint32_t)window < shm->nwindows && window < MICROSHM_WINDOWS ? 0 : -1;
+		if (ret == 0)
+			*w = shm->win[window];
+	} while (seqlock_read_retry(&shm->lock, seq));
+
+	return ret;
+}
+
+#endif
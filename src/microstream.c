@@ -0,0 +1,658 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include "micro.h"
+#include "microadc.h"
+#include "microcal.h"
+#include "microcic.h"
+#include "microlog.h"
+#include "microsched.h"
+#include "microshm.h"
+#include "microstream.h"
+#include "microtrig.h"
+#include "railstats.h"
+
+static struct microstream_rec ring[MICROSTREAM_RING];
+static uint64_t ring_head, ring_tail;
+static struct microstream_rec capture[MICROSTREAM_CAPTURE];
+static volatile sig_atomic_t streaming = 1;
+
+static void stream_stop(int sig)
+{
+	streaming = 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Writes out up to max records from the tail of the ring.  Only the
+ * contiguous run is written, the rest goes on the next call.
+ */
+static int ring_drain(int fd, int max)
+{
+	uint64_t n = ring_head - ring_tail;
+	int idx = ring_tail % MICROSTREAM_RING;
+
+	if (n > (uint64_t)max)
+		n = max;
+	if (idx + n > MICROSTREAM_RING)
+		n = MICROSTREAM_RING - idx;
+	if (n == 0)
+		return 0;
+
+	if (write_all(fd, &ring[idx], n * sizeof(ring[0])))
+		return 1;
+	ring_tail += n;
+
+	return 0;
+}
+
+/* The timer keeps its own schedule, a slow read does not push the next
+ * sample back */
+static int sample_timer(int rate)
+{
+	struct itimerspec its;
+	int tfd;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (tfd < 0) {
+		perror("timerfd_create");
+		return -1;
+	}
+	its.it_interval.tv_sec = rate == 1;
+	its.it_interval.tv_nsec = rate == 1 ? 0 : 1000000000 / rate;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+		perror("timerfd_settime");
+		close(tfd);
+		return -1;
+	}
+
+	signal(SIGINT, stream_stop);
+	signal(SIGTERM, stream_stop);
+
+	return tfd;
+}
+
+struct sampler {
+	int tfd;
+	int i2cfd;
+	uint16_t i2caddr;
+	uint64_t seq; /* Timer ticks so far */
+	uint64_t samples;
+	uint64_t overruns;
+	uint64_t errors;
+};
+
+static int sampler_start(struct sampler *s, int i2cfd, uint16_t i2caddr, int rate)
+{
+	memset(s, 0, sizeof(*s));
+	s->i2cfd = i2cfd;
+	s->i2caddr = i2caddr;
+	s->tfd = sample_timer(rate);
+
+	return s->tfd < 0 ? -1 : 0;
+}
+
+/*
+ * Waits for the next tick and reads the frame into rec.  Returns 0 for a
+ * sample, 1 if there is none this time around, or -1 if the timer failed.
+ */
+static int sampler_next(struct sampler *s, struct microstream_rec *rec)
+{
+	uint64_t exp, start;
+
+	if (read(s->tfd, &exp, sizeof(exp)) != sizeof(exp)) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 1;
+		perror("timerfd read");
+		return -1;
+	}
+	/* Every expiration past the first is a sample we did not take */
+	s->overruns += exp - 1;
+	s->seq += exp;
+
+	start = now_ns();
+	if (v0_stream_read(s->i2cfd, s->i2caddr, rec->frame, MICROSTREAM_FRAME) < 0) {
+		s->errors++;
+		return 1;
+	}
+	rec->ns = start;
+	rec->seq = s->seq;
+	rec->read_us = (now_ns() - start) / 1000;
+	rec->flags = 0;
+	s->samples++;
+
+	return 0;
+}
+
+static void sampler_report(struct sampler *s, const char *extra)
+{
+	close(s->tfd);
+	fprintf(stderr, "samples=%llu overruns=%llu errors=%llu%s\n", (unsigned long long)s->samples,
+		(unsigned long long)s->overruns, (unsigned long long)s->errors, extra);
+}
+
+static void stream_header(struct microstream_hdr *hdr, int model, int rate)
+{
+	memcpy(hdr->magic, MICROSTREAM_MAGIC, sizeof(hdr->magic));
+	hdr->version = MICROSTREAM_VERSION;
+	hdr->model = model;
+	hdr->period_ns = 1000000000 / rate;
+	hdr->frame_len = MICROSTREAM_FRAME;
+	hdr->rec_len = sizeof(struct microstream_rec);
+}
+
+int micro_stream(int i2cfd, uint16_t i2caddr, int model, int rate, int fd, uint64_t count)
+{
+	/* A pipe that polls writable takes at least PIPE_BUF without blocking */
+	const int chunk = PIPE_BUF / sizeof(struct microstream_rec);
+	struct microstream_hdr hdr;
+	struct pollfd pfds[2];
+	struct sampler smp;
+	uint64_t dropped = 0;
+	char extra[32];
+	int ret = 0;
+
+	stream_header(&hdr, model, rate);
+	if (write_all(fd, &hdr, sizeof(hdr))) {
+		perror("write");
+		return 1;
+	}
+
+	if (sampler_start(&smp, i2cfd, i2caddr, rate))
+		return 1;
+	signal(SIGPIPE, SIG_IGN);
+
+	pfds[0].fd = smp.tfd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = fd;
+	while (streaming && (count == 0 || smp.samples < count)) {
+		pfds[1].events = ring_head != ring_tail ? POLLOUT : 0;
+		if (poll(pfds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			ret = 1;
+			break;
+		}
+
+		if (pfds[1].revents & (POLLOUT | POLLERR | POLLHUP)) {
+			if (ring_drain(fd, chunk)) {
+				perror("write");
+				ret = 1;
+				break;
+			}
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			int r;
+
+			if (ring_head - ring_tail == MICROSTREAM_RING) {
+				ring_tail++;
+				dropped++;
+			}
+			r = sampler_next(&smp, &ring[ring_head % MICROSTREAM_RING]);
+			if (r < 0) {
+				ret = 1;
+				break;
+			}
+			if (r == 0)
+				ring_head++;
+		}
+	}
+
+	while (ret == 0 && ring_head != ring_tail) {
+		if (ring_drain(fd, MICROSTREAM_RING)) {
+			perror("write");
+			ret = 1;
+		}
+	}
+
+	snprintf(extra, sizeof(extra), " dropped=%llu", (unsigned long long)dropped);
+	sampler_report(&smp, extra);
+
+	return ret;
+}
+
+/* Writes capture records first up to end, which are at most size apart */
+static int capture_write(const char *path, const struct microstream_hdr *hdr, uint64_t first, uint64_t end,
+			 int size)
+{
+	int fd, ret = 0;
+	uint64_t i;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	ret = write_all(fd, hdr, sizeof(*hdr));
+	/* At most two runs, before and after the ring wraps */
+	for (i = first; ret == 0 && i < end;) {
+		int idx = i % size;
+		uint64_t n = end - i;
+
+		if (idx + n > (uint64_t)size)
+			n = size - idx;
+		ret = write_all(fd, &capture[idx], n * sizeof(capture[0]));
+		i += n;
+	}
+	if (close(fd) < 0)
+		ret = 1;
+	if (ret)
+		perror(path);
+
+	return ret;
+}
+
+int micro_capture(int i2cfd, uint16_t i2caddr, int model, int rate, struct microtrig *trigs, int ntrigs, int pre,
+		  int post, const char *path, uint64_t count)
+{
+	const struct micro_adc_model *adc = microcal_get_model(model);
+	const int size = pre + 1 + post;
+	uint64_t head = 0, fired = 0, first, captures = 0;
+	struct microstream_hdr hdr;
+	struct sampler smp;
+	uint32_t val[MICRO_ADC_CHANS];
+	int remaining = -1;
+	char name[4096], extra[32];
+	int i, r;
+	int ret = 0;
+
+	if (adc == NULL) {
+		fprintf(stderr, "No ADC channels for model 0x%X\n", model);
+		return 1;
+	}
+	if (size > MICROSTREAM_CAPTURE) {
+		fprintf(stderr, "At most %d samples per capture\n", MICROSTREAM_CAPTURE);
+		return 1;
+	}
+	stream_header(&hdr, model, rate);
+
+	if (sampler_start(&smp, i2cfd, i2caddr, rate))
+		return 1;
+
+	/* Only this loop touches the ring, so it needs no locking.  Samples
+	 * go in at head and the last size of them are always kept. */
+	while (streaming && (count == 0 || captures < count)) {
+		struct microstream_rec *rec = &capture[head % size];
+
+		r = sampler_next(&smp, rec);
+		if (r < 0) {
+			ret = 1;
+			break;
+		}
+		if (r > 0)
+			continue;
+		head++;
+
+		micro_adc_convert(adc, rec->frame, 0, 1, val);
+		for (i = 0; i < ntrigs; i++) {
+			if (microtrig_check(&trigs[i], rec->ns, val) && remaining < 0) {
+				fprintf(stderr, "%s triggered at %llu.%09llu\n", trigs[i].expr,
+					(unsigned long long)(rec->ns / 1000000000),
+					(unsigned long long)(rec->ns % 1000000000));
+				rec->flags |= MICROSTREAM_TRIGGER;
+				fired = head - 1;
+				remaining = post;
+			}
+		}
+
+		if (remaining < 0 || remaining-- > 0)
+			continue;
+
+		captures++;
+		if (count == 1)
+			snprintf(name, sizeof(name), "%s", path);
+		else
+			snprintf(name, sizeof(name), "%s.%llu", path, (unsigned long long)captures);
+		/* Fewer than pre samples if it triggered right after starting */
+		first = fired > (uint64_t)pre ? fired - pre : 0;
+		if (capture_write(name, &hdr, first, head, size)) {
+			ret = 1;
+			break;
+		}
+		fprintf(stderr, "Wrote %llu samples to %s\n", (unsigned long long)(head - first), name);
+	}
+
+	snprintf(extra, sizeof(extra), " captures=%llu", (unsigned long long)captures);
+	sampler_report(&smp, extra);
+
+	return ret;
+}
+
+static struct microshm *publish_setup(const struct micro_adc_model *adc, int rate)
+{
+	struct microshm *shm;
+	int fd, i;
+
+	fd = shm_open(MICROSHM_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		perror("shm_open");
+		return NULL;
+	}
+
+	if (ftruncate(fd, sizeof(*shm)) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return NULL;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	/* Readers that mapped an earlier segment see it go stale, not torn */
+	__atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+	memset(shm, 0, sizeof(*shm));
+	shm->model = adc->model;
+	shm->period_ns = 1000000000 / rate;
+	shm->nchans = adc->nchans;
+	for (i = 0; i < adc->nchans; i++) {
+		shm->unit[i] = adc->chans[i].unit;
+		strncpy(shm->name[i], adc->chans[i].name, MICROSHM_NAME_LEN - 1);
+	}
+	__atomic_store_n(&shm->magic, MICROSHM_MAGIC, __ATOMIC_RELEASE);
+
+	return shm;
+}
+
+int micro_publish(int i2cfd, uint16_t i2caddr, int model, int rate, const int *windows, int nwindows)
+{
+	const struct micro_adc_model *adc = microcal_get_model(model);
+	static struct railstats rs;
+	struct microshm_window win[MICROSHM_WINDOWS];
+	struct microstream_rec rec;
+	struct microshm_sample *s;
+	struct microshm *shm;
+	struct sampler smp;
+	uint32_t val[MICRO_ADC_CHANS];
+	uint64_t stats_ns = 0;
+	int i, r;
+	int ret = 0;
+
+	if (adc == NULL) {
+		fprintf(stderr, "No ADC channels for model 0x%X\n", model);
+		return 1;
+	}
+
+	shm = publish_setup(adc, rate);
+	if (shm == NULL)
+		return 1;
+	railstats_init(&rs, adc, windows, nwindows);
+	shm->nwindows = nwindows;
+
+	if (sampler_start(&smp, i2cfd, i2caddr, rate))
+		return 1;
+
+	while (streaming) {
+		r = sampler_next(&smp, &rec);
+		if (r < 0) {
+			ret = 1;
+			break;
+		}
+		if (r > 0)
+			continue;
+
+		/* Decode outside the lock so readers retry as little as possible */
+		micro_adc_convert(adc, rec.frame, 0, 1, val);
+		railstats_add(&rs, rec.ns, rec.frame);
+		if (rec.ns - stats_ns >= MICROSHM_STATS_MS * 1000000ULL) {
+			for (i = 0; i < nwindows; i++)
+				railstats_get(&rs, i, rec.ns, &win[i]);
+		}
+		s = &shm->hist[shm->count % MICROSHM_HISTORY];
+		seqlock_write_begin(&shm->lock);
+		s->ns = rec.ns;
+		s->seq = smp.samples - 1;
+		memcpy(s->val, val, sizeof(val));
+		memcpy(s->frame, rec.frame, sizeof(s->frame));
+		shm->count++;
+		if (rec.ns - stats_ns >= MICROSHM_STATS_MS * 1000000ULL) {
+			memcpy(shm->win, win, nwindows * sizeof(win[0]));
+			stats_ns = rec.ns;
+		}
+		seqlock_write_end(&shm->lock);
+	}
+
+	shm_unlink(MICROSHM_NAME);
+	sampler_report(&smp, "");
+
+	return ret;
+}
+
+int micro_decimate(int i2cfd, uint16_t i2caddr, int model, int rate, int ratio, int order, uint64_t count)
+{
+	const struct micro_adc_model *adc = microcal_get_model(model);
+	uint64_t out[MICRO_ADC_CHANS], outputs = 0;
+	struct microstream_rec rec;
+	struct microcic cic;
+	struct sampler smp;
+	double scale;
+	int i, r;
+	int ret = 0;
+
+	if (microcic_init(&cic, order, ratio) < 0)
+		return 1;
+	if (sampler_start(&smp, i2cfd, i2caddr, rate))
+		return 1;
+
+	while (streaming && (count == 0 || outputs < count)) {
+		r = sampler_next(&smp, &rec);
+		if (r < 0) {
+			ret = 1;
+			break;
+		}
+		/* A missed frame is left out rather than filled in, so a block
+		 * just spans a little longer */
+		if (r > 0 || !microcic_add(&cic, rec.frame, out))
+			continue;
+
+		printf("%llu.%09llu", (unsigned long long)(rec.ns / 1000000000), (unsigned long long)(rec.ns % 1000000000));
+		for (i = 0; i < adc->nchans; i++) {
+			if (adc->chans[i].hex)
+				continue;
+			scale = (double)adc->gain[i] / ((double)cic.gain * (1 << MICRO_ADC_SHIFT));
+			printf(" %s=%.3f", adc->chans[i].name,
+			       out[i] * scale + (double)adc->bias[i] / (1 << MICRO_ADC_SHIFT));
+		}
+		printf("\n");
+		fflush(stdout);
+		outputs++;
+	}
+
+	sampler_report(&smp, "");
+
+	return ret;
+}
+
+int micro_schedule(int i2cfd, uint16_t i2caddr, struct microsched *sched, uint64_t count)
+{
+	const struct micro_adc_model *adc = sched->adc;
+	uint64_t reads = 0, bytes = 0, errors = 0, missed = 0;
+	struct microsched_read r;
+	struct timespec ts;
+	uint8_t frame[MICROSTREAM_FRAME] = { 0 };
+	uint32_t val[MICRO_ADC_CHANS];
+	uint64_t next, start;
+	int i;
+
+	signal(SIGINT, stream_stop);
+	signal(SIGTERM, stream_stop);
+
+	microsched_start(sched, now_ns());
+	while (streaming && (count == 0 || reads < count)) {
+		next = microsched_next(sched);
+		ts.tv_sec = next / 1000000000;
+		ts.tv_nsec = next % 1000000000;
+		if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+			continue;
+
+		start = now_ns();
+		if (!microsched_plan(sched, start, &r))
+			continue;
+		if (micro_read(i2cfd, i2caddr, sched->addressed, r.off, frame + r.off, r.len) < 0) {
+			errors++;
+			/* Try again on the next deadline rather than spin */
+			microsched_done(sched, &r, start);
+			continue;
+		}
+		microsched_done(sched, &r, start);
+		reads++;
+		bytes += r.len + (r.off ? MICROSCHED_ADDR_BYTES : 0);
+
+		micro_adc_convert(adc, frame, 0, 1, val);
+		printf("%llu.%09llu", (unsigned long long)(start / 1000000000), (unsigned long long)(start % 1000000000));
+		for (i = 0; i < adc->nchans; i++) {
+			if (!(r.mask & (1 << i)))
+				continue;
+			if (adc->chans[i].hex)
+				printf(" %s=0x%X", adc->chans[i].name, val[i]);
+			else
+				printf(" %s=%d", adc->chans[i].name, val[i]);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	for (i = 0; i < sched->n; i++)
+		missed += sched->c[i].missed;
+	fprintf(stderr, "reads=%llu bytes=%llu errors=%llu missed=%llu, full frames would be %llu bytes\n",
+		(unsigned long long)reads, (unsigned long long)bytes, (unsigned long long)errors,
+		(unsigned long long)missed, (unsigned long long)reads * MICROSTREAM_FRAME);
+
+	return 0;
+}
+
+static struct microlog microlog;
+
+static uint64_t realtime_offset(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec - now_ns();
+}
+
+int micro_log(int i2cfd, uint16_t i2caddr, int model, int rate, const char *dir, int nsegs, int flush_s,
+	      uint64_t count)
+{
+	const struct micro_adc_model *adc = microcal_get_model(model);
+	struct microstream_rec rec;
+	struct sampler smp;
+	uint64_t offset, flushed;
+	char extra[64];
+	int r;
+	int ret = 0;
+
+	if (microlog_open(&microlog, dir, nsegs, model, adc->nchans) < 0)
+		return 1;
+	if (sampler_start(&smp, i2cfd, i2caddr, rate))
+		return 1;
+
+	/* Samples are logged in wall clock time so they mean something after
+	 * a reboot.  The offset is taken again at every flush to follow any
+	 * steps NTP makes. */
+	offset = realtime_offset();
+	flushed = now_ns();
+	while (streaming && (count == 0 || smp.samples < count)) {
+		r = sampler_next(&smp, &rec);
+		if (r < 0) {
+			ret = 1;
+			break;
+		}
+		if (r > 0)
+			continue;
+
+		if (microlog_add(&microlog, rec.ns + offset, rec.frame) < 0) {
+			ret = 1;
+			break;
+		}
+		if (rec.ns - flushed >= flush_s * 1000000000ULL) {
+			if (microlog_flush(&microlog, 0) < 0) {
+				ret = 1;
+				break;
+			}
+			offset = realtime_offset();
+			flushed = rec.ns;
+		}
+	}
+
+	if (microlog_close(&microlog) < 0)
+		ret = 1;
+	snprintf(extra, sizeof(extra), " blocks=%llu", (unsigned long long)microlog.written);
+	sampler_report(&smp, extra);
+
+	return ret;
+}
+
+int micro_average(int i2cfd, uint16_t i2caddr, int rate, uint64_t count, uint32_t *mean_q8)
+{
+	uint64_t sum[MICRO_ADC_CHANS] = { 0 };
+	struct microstream_rec rec;
+	struct sampler smp;
+	int c, r;
+	int ret = 0;
+
+	if (sampler_start(&smp, i2cfd, i2caddr, rate))
+		return 1;
+
+	while (streaming && smp.samples < count) {
+		r = sampler_next(&smp, &rec);
+		if (r < 0) {
+			ret = 1;
+			break;
+		}
+		if (r > 0)
+			continue;
+		for (c = 0; c < MICRO_ADC_CHANS; c++)
+			sum[c] += micro_adc_raw(rec.frame, c);
+	}
+
+	if (smp.samples < count)
+		ret = 1;
+	for (c = 0; c < MICRO_ADC_CHANS && smp.samples; c++)
+		mean_q8[c] = ((sum[c] << 8) + smp.samples / 2) / smp.samples;
+	close(smp.tfd);
+
+	return ret;
+}
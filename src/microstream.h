@@ -0,0 +1,103 @@
+#ifndef __MICROSTREAM_H_
+#define __MICROSTREAM_H_
+
+#include <stdint.h>
+
+/*
+ * Binary ADC stream written by tsmicroctl --stream
+ *
+ * A 16 byte header followed by one 48 byte record per sample, in host byte
+ * order (little endian on every board this runs on).  Records hold the raw
+ * v0 frame as read from the microcontroller, decode the channels with
+ * micro_adc_raw().  A gap in seq is a sample the timer fired for but that
+ * was not taken, or was dropped because the reader fell behind.
+ */
+#define MICROSTREAM_MAGIC "TSMS"
+#define MICROSTREAM_VERSION 1
+#define MICROSTREAM_FRAME 32
+
+/* Record flags */
+#define MICROSTREAM_TRIGGER 0x1 /* The sample a capture was triggered on */
+
+struct microstream_hdr {
+	char magic[4];
+	uint16_t version;
+	uint16_t model;
+	uint32_t period_ns;
+	uint16_t frame_len;
+	uint16_t rec_len;
+};
+
+struct microstream_rec {
+	uint64_t ns; /* CLOCK_MONOTONIC at the start of the read */
+	uint32_t seq; /* Timer tick the sample was taken on */
+	uint16_t read_us; /* Time the I2C read took */
+	uint16_t flags;
+	uint8_t frame[MICROSTREAM_FRAME];
+};
+
+/* Records buffered while the output is busy */
+#define MICROSTREAM_RING 1024
+/* Most samples one trigger capture can hold */
+#define MICROSTREAM_CAPTURE 16384
+
+/*
+ * Samples the ADC frame at i2caddr rate times a second and writes the
+ * stream to fd until count records are written, or forever if count is 0,
+ * or until SIGINT/SIGTERM.  Returns 0, or 1 on a setup or output error.
+ */
+int micro_stream(int i2cfd, uint16_t i2caddr, int model, int rate, int fd, uint64_t count);
+
+/*
+ * Samples the same way but publishes each decoded frame, and rolling
+ * statistics over windows of the given lengths in seconds, to the
+ * microshm.h shared memory segment instead, until SIGINT/SIGTERM.
+ */
+int micro_publish(int i2cfd, uint16_t i2caddr, int model, int rate, const int *windows, int nwindows);
+
+/*
+ * Samples the same way and prints one line per ratio samples with every
+ * channel oversampled and decimated by an order order CIC filter (see
+ * microcic.h), in mV or uA with the extra resolution as decimals.  Stops
+ * after count lines, or runs until SIGINT/SIGTERM if count is 0.
+ */
+int micro_decimate(int i2cfd, uint16_t i2caddr, int model, int rate, int ratio, int order, uint64_t count);
+
+/*
+ * Samples the same way into the compact log in dir (see microlog.h), a ring
+ * of nsegs segment files, writing out full blocks every flush_s seconds.
+ * Stops after count samples, or runs until SIGINT/SIGTERM if count is 0.
+ */
+int micro_log(int i2cfd, uint16_t i2caddr, int model, int rate, const char *dir, int nsegs, int flush_s,
+	      uint64_t count);
+
+/*
+ * Samples count frames the same way and returns the mean code of every
+ * channel in 1/256ths, for calibration.  Returns 1 if interrupted or the
+ * timer fails.
+ */
+int micro_average(int i2cfd, uint16_t i2caddr, int rate, uint64_t count, uint32_t *mean_q8);
+
+struct microsched;
+
+/*
+ * Reads the channels in sched at their own rates (see microsched.h) with
+ * as little of the frame as each deadline needs, printing a line of the
+ * channels served by each read.  Stops after count reads, or runs until
+ * SIGINT/SIGTERM if count is 0.
+ */
+int micro_schedule(int i2cfd, uint16_t i2caddr, struct microsched *sched, uint64_t count);
+
+struct microtrig;
+
+/*
+ * Samples continuously, keeping the last pre samples, until one of the
+ * triggers fires.  Then takes post more samples and writes the pre + 1 +
+ * post records as a stream to path, or to path.N when taking more than one
+ * capture.  Stops after count captures, or runs until SIGINT/SIGTERM if
+ * count is 0.
+ */
+int micro_capture(int i2cfd, uint16_t i2caddr, int model, int rate, struct microtrig *trigs, int ntrigs, int pre,
+		  int post, const char *path, uint64_t count);
+
+#endif
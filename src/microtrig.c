@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "microtrig.h"
+
+int microtrig_parse(struct microtrig *t, const struct micro_adc_model *adc, const char *expr)
+{
+	const char *op = strpbrk(expr, "<>");
+	const char *colon;
+	char *end;
+	int namelen;
+
+	memset(t, 0, sizeof(*t));
+	t->expr = expr;
+	t->chan = -1;
+	if (op == NULL) {
+		fprintf(stderr, "%s: expected CHAN<value or CHAN>value\n", expr);
+		return -1;
+	}
+
+	colon = memchr(expr, ':', op - expr);
+	namelen = (colon ? colon : op) - expr;
+	t->chan = micro_adc_find(adc, expr, namelen);
+	if (t->chan < 0) {
+		fprintf(stderr, "%s: no channel %.*s on this model\n", expr, namelen, expr);
+		return -1;
+	}
+
+	if (colon == NULL) {
+		t->kind = MICROTRIG_LEVEL;
+	} else if (op - colon - 1 == 5 && strncmp(colon + 1, "slope", 5) == 0) {
+		t->kind = MICROTRIG_SLOPE;
+	} else if (op - colon - 1 == 3 && strncmp(colon + 1, "dip", 3) == 0) {
+		t->kind = MICROTRIG_DIP;
+	} else {
+		fprintf(stderr, "%s: expected :slope or :dip\n", expr);
+		return -1;
+	}
+
+	t->below = *op == '<';
+	t->value = strtod(op + 1, &end);
+	if (end == op + 1 || *end != 0) {
+		fprintf(stderr, "%s: bad value\n", expr);
+		return -1;
+	}
+
+	return 0;
+}
+
+void microtrig_reset(struct microtrig *t)
+{
+	t->n = 0;
+	t->head = 0;
+	t->avg_ns = 0;
+	t->active = 0;
+}
+
+int microtrig_check(struct microtrig *t, uint64_t ns, const uint32_t *val)
+{
+	uint32_t v = val[t->chan];
+	double x = v, w;
+	int idx, hit, was;
+
+	switch (t->kind) {
+	case MICROTRIG_LEVEL:
+		break;
+	case MICROTRIG_SLOPE:
+		/* The oldest sample is compared with and then replaced by this one */
+		idx = t->head;
+		t->head = (t->head + 1) % MICROTRIG_SLOPE_SAMPLES;
+		if (t->n < MICROTRIG_SLOPE_SAMPLES || ns <= t->ns[idx]) {
+			if (t->n < MICROTRIG_SLOPE_SAMPLES)
+				t->n++;
+			t->ns[idx] = ns;
+			t->val[idx] = v;
+			return 0;
+		}
+		x = ((double)v - t->val[idx]) * 1e9 / (ns - t->ns[idx]);
+		t->ns[idx] = ns;
+		t->val[idx] = v;
+		break;
+	case MICROTRIG_DIP:
+		if (t->avg_ns == 0) {
+			t->avg = v;
+			t->avg_ns = ns;
+			return 0;
+		}
+		x = t->avg - v;
+		/* Average over about the last MICROTRIG_DIP_MS, updated after the
+		 * check so a sudden dip is not averaged in first */
+		w = (ns - t->avg_ns) / (MICROTRIG_DIP_MS * 1e6);
+		t->avg += (v - t->avg) * (w < 1 ? w : 1);
+		t->avg_ns = ns;
+		break;
+	}
+
+	hit = t->below ? x < t->value : x > t->value;
+	was = t->active;
+	t->active = hit;
+
+	return hit && !was;
+}
@@ -0,0 +1,52 @@
+#ifndef __MICROTRIG_H_
+#define __MICROTRIG_H_
+
+#include <stdint.h>
+
+#include "microadc.h"
+
+/*
+ * Trigger conditions on decoded ADC channels, written as
+ *
+ *	CHAN<value	CHAN>value		level in mV (uA for loops)
+ *	CHAN:slope<value			change in mV per second, over the
+ *						last MICROTRIG_SLOPE_SAMPLES samples
+ *	CHAN:dip>value				drop in mV below the channel's
+ *						average over about the last second
+ *
+ * for example "VIN<11000", "SUPERCAP:slope<-500" or "V5_A:dip>200".
+ */
+#define MICROTRIG_SLOPE_SAMPLES 8
+#define MICROTRIG_DIP_MS 1000
+
+enum microtrig_kind {
+	MICROTRIG_LEVEL,
+	MICROTRIG_SLOPE,
+	MICROTRIG_DIP,
+};
+
+struct microtrig {
+	const char *expr;
+	int chan;
+	enum microtrig_kind kind;
+	int below; /* Fires when less than value, otherwise greater */
+	double value;
+
+	/* Recent samples for slopes, and the running average for dips */
+	uint64_t ns[MICROTRIG_SLOPE_SAMPLES];
+	uint32_t val[MICROTRIG_SLOPE_SAMPLES];
+	int n;
+	int head;
+	double avg;
+	uint64_t avg_ns;
+	int active;
+};
+
+/* Returns 0, or -1 with a message if expr does not parse for this model */
+int microtrig_parse(struct microtrig *t, const struct micro_adc_model *adc, const char *expr);
+void microtrig_reset(struct microtrig *t);
+/* Feeds one decoded frame, returns 1 when the condition goes from false to
+ * true */
+int microtrig_check(struct microtrig *t, uint64_t ns, const uint32_t *val);
+
+#endif
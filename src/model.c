@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "i2cbus.h"
+#include "model.h"
+
+int get_model(void)
+{
+	int fd;
+	char mdl[256] = { 0 }; // Ensure the buffer is zero-initialized
+	char *ptr;
+	ssize_t ret;
+
+	// tshwctld already knows, skip reading the device tree
+	if (i2cbus_model())
+		return i2cbus_model();
+
+	// Open the model file using open system call
+	fd = open("/proc/device-tree/model", O_RDONLY);
+	if (fd < 0) {
+		perror("model");
+		return 0;
+	}
+
+	// Read the contents of the model file
+	ret = read(fd, mdl, sizeof(mdl) - 1); // Read up to 255 bytes
+	close(fd); // Close the file after reading
+
+	if (ret < 0) {
+		perror("read");
+		return 0;
+	}
+
+	// Null-terminate the string
+	mdl[ret] = '\0';
+
+	// Find the "TS-" substring
+	ptr = strstr(mdl, "TS-");
+	if (!ptr) {
+		fprintf(stderr, "Unsupported model: %s\n", mdl);
+		return 0;
+	}
+
+	// Convert the number after "TS-" to a hexadecimal value
+	return (int)strtoul(ptr + 3, NULL, 16);
+}
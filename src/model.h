@@ -0,0 +1,6 @@
+#ifndef __MODEL_H_
+#define __MODEL_H_
+
+int get_model(void);
+
+#endif
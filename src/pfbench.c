@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "lathist.h"
+
+/*
+ * Power fail latency benchmark
+ *
+ * Runs tssilomon against a gpio-sim line standing in for POWER_FAIL and the
+ * simulated I2C bus standing in for the microcontroller, with the supercaps
+ * already below the reset level.  Each iteration pulls the line high, waits
+ * for tssilomon to decide to shut down (in dry run mode), then pulls it low
+ * again.  Optional CPU and I/O stress runs alongside.  Needs root and the
+ * gpio-sim module.
+ */
+
+#define GPIOSIM_CONFIGFS "/sys/kernel/config/gpio-sim"
+#define SIM_LINE 4
+#define TIMEOUT_MS 5000
+
+static char sim_dir[128];
+static char pull_path[256];
+static pid_t children[256];
+static int nchildren;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_str(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY);
+	int ret = 0;
+
+	if (fd < 0 || write(fd, val, strlen(val)) != (ssize_t)strlen(val)) {
+		perror(path);
+		ret = 1;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	return ret;
+}
+
+static int read_str(const char *path, char *buf, int len)
+{
+	int fd = open(path, O_RDONLY);
+	ssize_t n;
+
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n <= 0)
+		return 1;
+	buf[n] = 0;
+	buf[strcspn(buf, "\n")] = 0;
+
+	return 0;
+}
+
+static void gpiosim_teardown(void)
+{
+	char path[256];
+
+	if (sim_dir[0] == 0)
+		return;
+	snprintf(path, sizeof(path), "%s/live", sim_dir);
+	write_str(path, "0");
+	snprintf(path, sizeof(path), "%s/bank0", sim_dir);
+	rmdir(path);
+	rmdir(sim_dir);
+	sim_dir[0] = 0;
+}
+
+/* Creates a gpio-sim chip and returns its name in chip */
+static int gpiosim_setup(char *chip, int len)
+{
+	char path[256], dev[64];
+
+	snprintf(sim_dir, sizeof(sim_dir), GPIOSIM_CONFIGFS "/pfbench-%d", getpid());
+	if (mkdir(sim_dir, 0755) < 0) {
+		perror(sim_dir);
+		fprintf(stderr, "gpio-sim is not available, try \"modprobe gpio-sim\"\n");
+		sim_dir[0] = 0;
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "%s/bank0", sim_dir);
+	if (mkdir(path, 0755) < 0) {
+		perror(path);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/bank0/num_lines", sim_dir);
+	if (write_str(path, "8"))
+		return 1;
+	snprintf(path, sizeof(path), "%s/live", sim_dir);
+	if (write_str(path, "1"))
+		return 1;
+
+	snprintf(path, sizeof(path), "%s/dev_name", sim_dir);
+	if (read_str(path, dev, sizeof(dev)))
+		return 1;
+	snprintf(path, sizeof(path), "%s/bank0/chip_name", sim_dir);
+	if (read_str(path, chip, len))
+		return 1;
+
+	snprintf(pull_path, sizeof(pull_path), "/sys/devices/platform/%s/%s/sim_gpio%d/pull", dev, chip, SIM_LINE);
+
+	return write_str(pull_path, "pull-down");
+}
+
+static void spawn_stress(int ncpu, int nio, const char *dir)
+{
+	static char buf[1 << 20];
+	int i;
+
+	for (i = 0; i < ncpu + nio && nchildren < (int)(sizeof(children) / sizeof(children[0])); i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return;
+		}
+		if (pid > 0) {
+			children[nchildren++] = pid;
+			continue;
+		}
+
+		if (i < ncpu) {
+			volatile uint64_t spin = 0;
+
+			for (;;)
+				spin++;
+		} else {
+			char path[256];
+			int fd;
+
+			snprintf(path, sizeof(path), "%s/pfbench-io-%d", dir, getpid());
+			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+			unlink(path);
+			if (fd < 0)
+				_exit(1);
+			memset(buf, 0x5a, sizeof(buf));
+			for (;;) {
+				if (write(fd, buf, sizeof(buf)) < 0 || fsync(fd) < 0 ||
+				    lseek(fd, 0, SEEK_SET) < 0)
+					_exit(1);
+			}
+		}
+	}
+}
+
+static pid_t spawn_monitor(char **argv, int *outfd)
+{
+	int pfd[2];
+	pid_t pid;
+
+	if (pipe(pfd) < 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		dup2(pfd[1], STDOUT_FILENO);
+		close(pfd[0]);
+		close(pfd[1]);
+		setenv("TS_I2C_BACKEND", "sim", 1);
+		setenv("TS_I2C_SIM_MODEL", "7990", 1);
+		/* About 75%, under the --pct 90 floor */
+		setenv("TS_I2C_SIM_SUPERCAP_MV", "9000", 1);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	close(pfd[1]);
+	*outfd = pfd[0];
+	if (pid < 0)
+		perror("fork");
+
+	return pid;
+}
+
+/* Reads lines from the monitor until one contains match, which is returned
+ * in line.  Returns 1 on timeout or if the monitor exits. */
+static int wait_line(int fd, const char *match, char *line, int len)
+{
+	static char buf[4096];
+	static int used;
+	uint64_t deadline = now_ns() + TIMEOUT_MS * 1000000ULL;
+
+	for (;;) {
+		char *nl = memchr(buf, '\n', used);
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		uint64_t now;
+		ssize_t n;
+
+		if (nl) {
+			int linelen = nl - buf;
+			int found;
+
+			*nl = 0;
+			found = strstr(buf, match) != NULL;
+			if (found) {
+				strncpy(line, buf, len - 1);
+				line[len - 1] = 0;
+			}
+			memmove(buf, nl + 1, used - linelen - 1);
+			used -= linelen + 1;
+			if (found)
+				return 0;
+			continue;
+		}
+
+		now = now_ns();
+		if (now >= deadline || poll(&pfd, 1, (deadline - now) / 1000000 + 1) <= 0)
+			break;
+		n = read(fd, buf + used, sizeof(buf) - 1 - used);
+		if (n <= 0)
+			break;
+		used += n;
+	}
+
+	fprintf(stderr, "Timed out waiting for \"%s\" from the monitor\n", match);
+	return 1;
+}
+
+static void report(const char *what, const struct lathist *h)
+{
+	printf("%-22s %9.1f %9.1f %9.1f %9.1f\n", what, lathist_percentile(h, 50) / 1000.0,
+	       lathist_percentile(h, 99) / 1000.0, lathist_percentile(h, 99.9) / 1000.0, h->max / 1000.0);
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS]\n"
+		"embeddedTS power fail latency benchmark\n"
+		"\n"
+		"  -n, --iterations <n>   Power fail events to simulate (default 200)\n"
+		"  -c, --cpu <n>          CPU stress workers (default 0)\n"
+		"  -i, --io <n>           I/O stress workers (default 0)\n"
+		"  -d, --dir <path>       Directory for I/O stress files (default /tmp)\n"
+		"  -r, --realtime <prio>  Run tssilomon with --realtime prio\n"
+		"  -m, --monitor <path>   tssilomon to run (default ./tssilomon)\n"
+		"  -h, --help             This message\n"
+		"\n"
+		"Needs root and the gpio-sim module.\n"
+		"\n",
+		argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	struct lathist sample_hist, action_hist, seen_hist;
+	char *monitor = "./tssilomon";
+	char *rt_prio = NULL;
+	char *dir = "/tmp";
+	char chip[64], gpio[80], line[256];
+	char *margv[12];
+	int iterations = 200;
+	int ncpu = 0, nio = 0;
+	int outfd = -1;
+	int ret = 1;
+	int c, i, n;
+	pid_t pid;
+
+	static struct option long_options[] = { { "iterations", required_argument, 0, 'n' },
+						{ "cpu", required_argument, 0, 'c' },
+						{ "io", required_argument, 0, 'i' },
+						{ "dir", required_argument, 0, 'd' },
+						{ "realtime", required_argument, 0, 'r' },
+						{ "monitor", required_argument, 0, 'm' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "n:c:i:d:r:m:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'c':
+			ncpu = atoi(optarg);
+			break;
+		case 'i':
+			nio = atoi(optarg);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'r':
+			rt_prio = optarg;
+			break;
+		case 'm':
+			monitor = optarg;
+			break;
+		case 'h':
+			usage(argv);
+			return 0;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (iterations < 1) {
+		usage(argv);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	if (gpiosim_setup(chip, sizeof(chip)))
+		goto out;
+
+	snprintf(gpio, sizeof(gpio), "%s:%d", chip, SIM_LINE);
+	n = 0;
+	margv[n++] = monitor;
+	margv[n++] = "--dry-run";
+	margv[n++] = "--force";
+	/* The simulated caps hold steady, so trip on the floor rather than
+	 * waiting for the predictor */
+	margv[n++] = "--pct";
+	margv[n++] = "90";
+	margv[n++] = "--gpio";
+	margv[n++] = gpio;
+	if (rt_prio) {
+		margv[n++] = "--realtime";
+		margv[n++] = rt_prio;
+	}
+	margv[n] = NULL;
+
+	pid = spawn_monitor(margv, &outfd);
+	if (pid < 0)
+		goto out;
+	children[nchildren++] = pid;
+	/* Give it time to open the line before the first edge */
+	usleep(200000);
+
+	spawn_stress(ncpu, nio, dir);
+
+	lathist_init(&sample_hist);
+	lathist_init(&action_hist);
+	lathist_init(&seen_hist);
+	for (i = 0; i < iterations; i++) {
+		long long sample_us, action_us;
+		uint64_t start;
+		char *p;
+
+		start = now_ns();
+		if (write_str(pull_path, "pull-up") || wait_line(outfd, "shutdown", line, sizeof(line)))
+			goto out;
+		lathist_add(&seen_hist, now_ns() - start);
+
+		p = strstr(line, "sampled");
+		if (p == NULL || sscanf(p, "sampled %lld us, shutdown %lld us", &sample_us, &action_us) != 2) {
+			fprintf(stderr, "Unexpected output \"%s\"\n", line);
+			goto out;
+		}
+		lathist_add(&sample_hist, sample_us * 1000);
+		lathist_add(&action_hist, action_us * 1000);
+
+		if (write_str(pull_path, "pull-down") || wait_line(outfd, "restored", line, sizeof(line)))
+			goto out;
+		/* Spread the edges out a little so they do not line up with
+		 * the stress workers */
+		usleep(5000 + rand() % 5000);
+	}
+
+	printf("%d power fail events, %d CPU and %d I/O stress workers%s\n", iterations, ncpu, nio,
+	       rt_prio ? ", realtime" : "");
+	printf("%-22s %9s %9s %9s %9s\n", "latency", "p50 us", "p99 us", "p999 us", "max us");
+	report("edge to sample", &sample_hist);
+	report("edge to shutdown", &action_hist);
+	report("pull to report", &seen_hist);
+	ret = 0;
+
+out:
+	for (i = 0; i < nchildren; i++)
+		kill(children[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+	gpiosim_teardown();
+
+	return ret;
+}
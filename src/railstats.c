@@ -0,0 +1,153 @@
+#include <math.h>
+#include <string.h>
+
+#include "railstats.h"
+
+void railstats_init(struct railstats *rs, const struct micro_adc_model *adc, const int *seconds, int nwindows)
+{
+	int i;
+
+	memset(rs, 0, sizeof(*rs));
+	rs->adc = adc;
+	rs->nwindows = nwindows;
+	for (i = 0; i < nwindows; i++)
+		rs->w[i].span_ns = seconds[i] * 1000000000ULL;
+}
+
+static void acc_sub(struct railstats_acc *total, const struct railstats_acc *acc)
+{
+	int i;
+
+	total->n -= acc->n;
+	total->sum -= acc->sum;
+	total->sumsq -= acc->sumsq;
+	for (i = 0; i < RAILSTATS_BINS; i++)
+		total->hist[i] -= acc->hist[i];
+}
+
+/* Moves the window on so the current bucket covers ns */
+static void window_advance(struct railstats_window *w, int nchans, uint64_t ns)
+{
+	uint64_t bucket_ns = w->span_ns / RAILSTATS_BUCKETS;
+	int c, steps;
+
+	if (w->start_ns == 0) {
+		w->start_ns = ns;
+		return;
+	}
+
+	for (steps = 0; ns - w->start_ns >= bucket_ns; steps++) {
+		/* Idle for longer than the window, nothing is left to retire */
+		if (steps == RAILSTATS_BUCKETS) {
+			w->start_ns = ns;
+			break;
+		}
+
+		w->cur = (w->cur + 1) % RAILSTATS_BUCKETS;
+		w->start_ns += bucket_ns;
+		for (c = 0; c < nchans; c++) {
+			acc_sub(&w->total[c], &w->b[c][w->cur].acc);
+			memset(&w->b[c][w->cur], 0, sizeof(w->b[c][w->cur]));
+		}
+	}
+}
+
+void railstats_add(struct railstats *rs, uint64_t ns, const uint8_t *frame)
+{
+	int i, c;
+
+	for (i = 0; i < rs->nwindows; i++) {
+		struct railstats_window *w = &rs->w[i];
+
+		window_advance(w, rs->adc->nchans, ns);
+		for (c = 0; c < rs->adc->nchans; c++) {
+			struct railstats_bucket *b = &w->b[c][w->cur];
+			uint16_t raw = micro_adc_raw(frame, c);
+			int bin = raw / RAILSTATS_CODES_PER_BIN;
+
+			if (bin >= RAILSTATS_BINS)
+				bin = RAILSTATS_BINS - 1;
+			if (b->acc.n == 0 || raw < b->min)
+				b->min = raw;
+			if (b->acc.n == 0 || raw > b->max)
+				b->max = raw;
+			b->acc.n++;
+			b->acc.sum += raw;
+			b->acc.sumsq += (uint64_t)raw * raw;
+			b->acc.hist[bin]++;
+			w->total[c].n++;
+			w->total[c].sum += raw;
+			w->total[c].sumsq += (uint64_t)raw * raw;
+			w->total[c].hist[bin]++;
+		}
+	}
+}
+
+/* Raw code for the pct percentile, interpolated within its bin and kept
+ * inside the range actually seen */
+static int percentile(const struct railstats_acc *acc, int pct, int min, int max)
+{
+	uint64_t want = (acc->n * pct + 99) / 100, seen = 0;
+	int i, raw;
+
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < RAILSTATS_BINS - 1; i++) {
+		if (seen + acc->hist[i] >= want)
+			break;
+		seen += acc->hist[i];
+	}
+
+	raw = i * RAILSTATS_CODES_PER_BIN;
+	if (acc->hist[i])
+		raw += (want - seen) * RAILSTATS_CODES_PER_BIN / acc->hist[i];
+	if (raw < min)
+		raw = min;
+	if (raw > max)
+		raw = max;
+
+	return raw;
+}
+
+void railstats_get(const struct railstats *rs, int window, uint64_t ns, struct microshm_window *out)
+{
+	const struct railstats_window *w = &rs->w[window];
+	int c, i;
+
+	memset(out, 0, sizeof(*out));
+	out->seconds = w->span_ns / 1000000000ULL;
+	out->ns = ns;
+
+	for (c = 0; c < rs->adc->nchans; c++) {
+		const struct railstats_acc *t = &w->total[c];
+		struct microshm_stat *s = &out->stat[c];
+		uint32_t gain = rs->adc->gain[c];
+		int32_t bias = rs->adc->bias[c];
+		double mean, var;
+		int min = 0xffff, max = 0;
+
+		out->n = t->n;
+		if (t->n == 0)
+			continue;
+
+		for (i = 0; i < RAILSTATS_BUCKETS; i++) {
+			const struct railstats_bucket *b = &w->b[c][i];
+
+			if (b->acc.n == 0)
+				continue;
+			if (b->min < min)
+				min = b->min;
+			if (b->max > max)
+				max = b->max;
+		}
+
+		mean = (double)t->sum / t->n;
+		var = (double)t->sumsq / t->n - mean * mean;
+		s->min = micro_adc_value(rs->adc, c, min);
+		s->max = micro_adc_value(rs->adc, c, max);
+		s->p1 = micro_adc_value(rs->adc, c, percentile(t, 1, min, max));
+		s->p99 = micro_adc_value(rs->adc, c, percentile(t, 99, min, max));
+		s->mean = (mean * gain + bias) / (1 << MICRO_ADC_SHIFT);
+		s->stddev = var > 0 ? sqrt(var) * gain / (1 << MICRO_ADC_SHIFT) : 0;
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef __RAILSTATS_H_
+#define __RAILSTATS_H_
+
+#include <stdint.h>
+
+#include "microadc.h"
+#include "microshm.h"
+
+/*
+ * Rolling statistics over the ADC channels for a few fixed windows.
+ *
+ * Each window is split into RAILSTATS_BUCKETS buckets that are retired
+ * whole, so a window covers between 9/10 and all of its span.  Samples are
+ * kept as raw ADC codes: each bucket and each window total hold a count,
+ * sum, sum of squares and a histogram of the codes, and a retired bucket is
+ * subtracted from the total.  Adding a sample is O(1), and a query is
+ * O(bins) for the percentiles and O(buckets) for min/max, in constant
+ * memory.  Percentiles are interpolated within bins of
+ * RAILSTATS_CODES_PER_BIN codes.
+ */
+#define RAILSTATS_BUCKETS 10
+#define RAILSTATS_BINS 256
+#define RAILSTATS_CODES_PER_BIN 4
+
+struct railstats_acc {
+	uint64_t n;
+	uint64_t sum;
+	uint64_t sumsq;
+	uint32_t hist[RAILSTATS_BINS];
+};
+
+struct railstats_bucket {
+	struct railstats_acc acc;
+	uint16_t min;
+	uint16_t max;
+};
+
+struct railstats_window {
+	uint64_t span_ns;
+	uint64_t start_ns; /* When the current bucket started */
+	int cur;
+	struct railstats_acc total[MICRO_ADC_CHANS];
+	struct railstats_bucket b[MICRO_ADC_CHANS][RAILSTATS_BUCKETS];
+};
+
+struct railstats {
+	const struct micro_adc_model *adc;
+	int nwindows;
+	struct railstats_window w[MICROSHM_WINDOWS];
+};
+
+/* seconds lists nwindows window lengths, at most MICROSHM_WINDOWS */
+void railstats_init(struct railstats *rs, const struct micro_adc_model *adc, const int *seconds, int nwindows);
+void railstats_add(struct railstats *rs, uint64_t ns, const uint8_t *frame);
+void railstats_get(const struct railstats *rs, int window, uint64_t ns, struct microshm_window *out);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __SEQLOCK_H_
+#define __SEQLOCK_H_
+
+#include <stdint.h>
+
+/*
+ * Sequence lock for data shared between one writer and any number of
+ * readers, usually through shared memory.  Readers never block the writer
+ * and never make a syscall, they retry if the writer was active while they
+ * copied the data.
+ *
+ * The writer brackets updates with seqlock_write_begin()/end().  Readers do:
+ *
+ *	do {
+ *		if (seqlock_read_begin(&lock, &seq) < 0)
+ *			... no writer ...
+ *		... copy data ...
+ *	} while (seqlock_read_retry(&lock, seq));
+ *
+ * A writer that dies inside an update leaves the lock held for good, so a
+ * reader only waits SEQLOCK_SPINS checks for it before giving up.
+ */
+#define SEQLOCK_SPINS (1 << 20)
+
+static inline void seqlock_write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns 0 with the sequence to check in *start, or -1 if the writer never
+ * finished its update */
+static inline int seqlock_read_begin(const uint32_t *seq, uint32_t *start)
+{
+	int i;
+
+	for (i = 0; i < SEQLOCK_SPINS; i++) {
+		*start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if (!(*start & 1))
+			return 0;
+	}
+
+	return -1;
+}
+
+static inline int seqlock_read_retry(const uint32_t *seq, uint32_t start)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "i2cbus.h"
+
+/*
+ * Startup benchmark
+ *
+ * Times how long it takes to find the FPGA/RTC I2C adapter with each of the
+ * discovery methods, and how long a utility takes from exec to finishing its
+ * first transaction, with a cold and a warm adapter cache.
+ */
+
+#define MAX_RUNS 10000
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *what, uint64_t *ns, int n)
+{
+	qsort(ns, n, sizeof(*ns), cmp_u64);
+	printf("%-28s min %8.1f us  median %8.1f us  max %8.1f us\n", what, ns[0] / 1000.0, ns[n / 2] / 1000.0,
+	       ns[n - 1] / 1000.0);
+}
+
+static void bench_find(const char *name, const char *what, int flags, uint64_t *ns, int runs)
+{
+	int bus = -1;
+	int i;
+
+	for (i = 0; i < runs; i++) {
+		uint64_t start = now_ns();
+		bus = i2cbus_find_adapter(name, flags);
+		ns[i] = now_ns() - start;
+	}
+	report(what, ns, runs);
+	if (bus == -1)
+		printf("%-28s (%s not found)\n", "", name);
+}
+
+/* Time from fork until the utility exits, its output is discarded */
+static uint64_t run_once(char **cmd)
+{
+	uint64_t start = now_ns();
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		int fd = open("/dev/null", O_WRONLY);
+
+		dup2(fd, STDOUT_FILENO);
+		execvp(cmd[0], cmd);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+		fprintf(stderr, "Unable to run %s\n", cmd[0]);
+		exit(1);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		fprintf(stderr, "%s exited with status %d\n", cmd[0], WEXITSTATUS(status));
+
+	return now_ns() - start;
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] [-- command ...]\n"
+		"embeddedTS utility startup benchmark\n"
+		"\n"
+		"  -n, --runs <count>     Iterations for each case (default 100)\n"
+		"  -a, --adapter <name>   Adapter to look up (default 21a0000.i2c)\n"
+		"  -h, --help             This message\n"
+		"\n"
+		"The command defaults to \"tshwctl -m 51 -t\", a single FPGA read.\n"
+		"The cold run removes the adapter cache first, so needs root.\n"
+		"\n",
+		argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	static char *defcmd[] = { "tshwctl", "-m", "51", "-t", NULL };
+	static uint64_t ns[MAX_RUNS];
+	char *adapter = "21a0000.i2c";
+	char **cmd = defcmd;
+	int runs = 100;
+	int c, i;
+
+	static struct option long_options[] = { { "runs", required_argument, 0, 'n' },
+						{ "adapter", required_argument, 0, 'a' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "n:a:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			runs = atoi(optarg);
+			if (runs < 1 || runs > MAX_RUNS) {
+				fprintf(stderr, "Runs must be 1-%d\n", MAX_RUNS);
+				return 1;
+			}
+			break;
+		case 'a':
+			adapter = optarg;
+			break;
+		case 'h':
+			usage(argv);
+			return 0;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		cmd = &argv[optind];
+
+	printf("Adapter discovery (%d runs):\n", runs);
+	bench_find(adapter, "full sysfs scan", I2CBUS_FIND_NOCACHE | I2CBUS_FIND_SCAN, ns, runs);
+	bench_find(adapter, "platform device", I2CBUS_FIND_NOCACHE, ns, runs);
+	bench_find(adapter, "boot_id cache", 0, ns, runs);
+
+	printf("\nExec to first transaction complete: %s ...\n", cmd[0]);
+	unlink(I2CBUS_CACHE);
+	ns[0] = run_once(cmd);
+	report("cold cache", ns, 1);
+	for (i = 0; i < runs; i++)
+		ns[i] = run_once(cmd);
+	report("warm cache", ns, runs);
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "cbarprof.h"
+#include "fpgaimg.h"
+
+static void usage(char **argv)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] <profile>\n"
+		"embeddedTS crossbar profile compiler\n"
+		"\n"
+		"  -o, --output <file>    Write the compiled register image here\n"
+		"  -h, --help             This message\n"
+		"\n"
+		"Without -o the profile is only checked.  Compiled profiles are\n"
+		"applied with \"tshwctl --apply-profile\".\n"
+		"\n",
+		argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	struct fpga_image img;
+	char *output = NULL;
+	int nregs = 0;
+	int c, i;
+
+	static struct option long_options[] = { { "output", required_argument, 0, 'o' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "o:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'h':
+			usage(argv);
+			return 0;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv);
+		return 1;
+	}
+
+	if (cbar_profile_compile(argv[optind], &img))
+		return 1;
+
+	for (i = 0; i < img.len; i++)
+		nregs += img.mask[i] != 0;
+	printf("%s: TS-%X, %d registers\n", argv[optind], img.model, nregs);
+
+	if (output && fpga_image_save(output, &img))
+		return 1;
+
+	return 0;
+}
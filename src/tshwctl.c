@@ -15,50 +15,30 @@
 #include <gpiod.h>
 #include <assert.h>
 #include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/timerfd.h>
 
 #include "fpga.h"
-#include "crossbar-ts4900.h"
-#include "crossbar-ts7970.h"
-#include "crossbar-ts7990.h"
+#include "crossbar.h"
+#include "fpgaimg.h"
+#include "cbarprof.h"
+#include "model.h"
+#include "tshwctld.h"
 
 static int i2cfd;
 
-int get_model()
-{
-	int fd;
-	char mdl[256] = { 0 }; // Ensure the buffer is zero-initialized
-	char *ptr;
-	ssize_t ret;
-
-	// Open the model file using open system call
-	fd = open("/proc/device-tree/model", O_RDONLY);
-	if (fd < 0) {
-		perror("model");
-		return 0;
-	}
-
-	// Read the contents of the model file
-	ret = read(fd, mdl, sizeof(mdl) - 1); // Read up to 255 bytes
-	close(fd); // Close the file after reading
-
-	if (ret < 0) {
-		perror("read");
-		return 0;
-	}
+/* Register ranges for --watch, each one is read as a single burst */
+#define WATCH_SPANS 32
+#define WATCH_REGS 2048
+#define WATCH_MAX_HZ 1000
 
-	// Null-terminate the string
-	mdl[ret] = '\0';
+struct watch_span {
+	uint16_t addr;
+	uint16_t len;
+};
 
-	// Find the "TS-" substring
-	ptr = strstr(mdl, "TS-");
-	if (!ptr) {
-		fprintf(stderr, "Unsupported model: %s\n", mdl);
-		return 0;
-	}
-
-	// Convert the number after "TS-" to a hexadecimal value
-	return (int)strtoul(ptr + 3, NULL, 16);
-}
+static volatile sig_atomic_t watching = 1;
 
 // Calculate the number of 24mhz clocks for a given
 // baud rate / bits per symbol
@@ -88,6 +68,8 @@ void auto485_en(int uart, int baud, char *mode)
 	int uartfd;
 	int symsz;
 	uint32_t cnt1, cnt2;
+	uint8_t cnt[6];
+	struct fpga_batch batch;
 
 	if (uart == 1)
 		uartfd = open("/dev/ttymxc1", O_RDONLY);
@@ -161,23 +143,19 @@ void auto485_en(int uart, int baud, char *mode)
 		printf("Setting Auto TXEN for %d baud and %d bits per symbol (%s)\n", baud, symsz, mode);
 	}
 
-	if (uart == 1) {
-		autotx_bitstoclks(symsz, baud, &cnt1, &cnt2);
-		fpoke8(i2cfd, 32, (uint8_t)((cnt1 & 0xff0000) >> 16));
-		fpoke8(i2cfd, 33, (uint8_t)((cnt1 & 0xff00) >> 8));
-		fpoke8(i2cfd, 34, (uint8_t)(cnt1 & 0xff));
-		fpoke8(i2cfd, 35, (uint8_t)((cnt2 & 0xff0000) >> 16));
-		fpoke8(i2cfd, 36, (uint8_t)((cnt2 & 0xff00) >> 8));
-		fpoke8(i2cfd, 37, (uint8_t)(cnt2 & 0xff));
-	} else if (uart == 3) {
-		autotx_bitstoclks(symsz, baud, &cnt1, &cnt2);
-		fpoke8(i2cfd, 38, (uint8_t)((cnt1 & 0xff0000) >> 16));
-		fpoke8(i2cfd, 39, (uint8_t)((cnt1 & 0xff00) >> 8));
-		fpoke8(i2cfd, 40, (uint8_t)(cnt1 & 0xff));
-		fpoke8(i2cfd, 41, (uint8_t)((cnt2 & 0xff0000) >> 16));
-		fpoke8(i2cfd, 42, (uint8_t)((cnt2 & 0xff00) >> 8));
-		fpoke8(i2cfd, 43, (uint8_t)(cnt2 & 0xff));
-	}
+	autotx_bitstoclks(symsz, baud, &cnt1, &cnt2);
+	cnt[0] = (uint8_t)((cnt1 & 0xff0000) >> 16);
+	cnt[1] = (uint8_t)((cnt1 & 0xff00) >> 8);
+	cnt[2] = (uint8_t)(cnt1 & 0xff);
+	cnt[3] = (uint8_t)((cnt2 & 0xff0000) >> 16);
+	cnt[4] = (uint8_t)((cnt2 & 0xff00) >> 8);
+	cnt[5] = (uint8_t)(cnt2 & 0xff);
+
+	// ttymxc1 counters are at 32-37, ttymxc3 at 38-43
+	fpga_batch_init(&batch, i2cfd);
+	fpga_batch_poke(&batch, uart == 1 ? 32 : 38, cnt, sizeof(cnt));
+	if (fpga_batch_commit(&batch))
+		fprintf(stderr, "Failed to write Auto TXEN counters\n");
 }
 
 int do_ts7990_info(int i2cfd)
@@ -563,6 +541,151 @@ cleanup:
 	return ret;
 }
 
+/* Parse "51,32-43,0x100" in to sorted spans, merging overlapping ranges */
+static int watch_parse(char *list, struct watch_span *spans)
+{
+	int nspans = 0;
+	int total = 0;
+	char *p = list;
+	int i, j;
+
+	while (*p) {
+		unsigned long start, end;
+		char *e;
+
+		start = strtoul(p, &e, 0);
+		end = start;
+		if (e != p && *e == '-')
+			end = strtoul(e + 1, &e, 0);
+		if (e == p || (*e != ',' && *e != 0) || end < start || end > 0xffff) {
+			fprintf(stderr, "Invalid watch range \"%s\"\n", p);
+			return -1;
+		}
+		p = *e ? e + 1 : e;
+
+		for (i = 0; i < nspans && spans[i].addr < start; i++)
+			;
+		if (nspans == WATCH_SPANS) {
+			fprintf(stderr, "Too many watch ranges, at most %d\n", WATCH_SPANS);
+			return -1;
+		}
+		memmove(&spans[i + 1], &spans[i], (nspans - i) * sizeof(*spans));
+		spans[i].addr = start;
+		spans[i].len = end - start + 1;
+		nspans++;
+	}
+
+	for (i = 0, j = 1; j < nspans; j++) {
+		if (spans[j].addr <= spans[i].addr + spans[i].len) {
+			int end = spans[j].addr + spans[j].len;
+
+			if (end > spans[i].addr + spans[i].len)
+				spans[i].len = end - spans[i].addr;
+		} else {
+			spans[++i] = spans[j];
+		}
+	}
+	if (nspans)
+		nspans = i + 1;
+
+	for (i = 0; i < nspans; i++)
+		total += spans[i].len;
+	if (total > WATCH_REGS) {
+		fprintf(stderr, "Too many registers to watch, at most %d\n", WATCH_REGS);
+		return -1;
+	}
+
+	return nspans;
+}
+
+static void watch_stop(int sig)
+{
+	watching = 0;
+}
+
+/*
+ * Read every span in one transaction per sample and print the registers
+ * that changed since the last one, starting with all of them.  At a rate of
+ * 0 samples are taken back to back as fast as the bus allows.
+ */
+int do_watch(int i2cfd, char *list, int rate)
+{
+	static uint8_t cur[WATCH_REGS], last[WATCH_REGS];
+	struct watch_span spans[WATCH_SPANS];
+	struct itimerspec its;
+	struct fpga_batch batch;
+	struct timespec ts;
+	uint64_t samples = 0, missed = 0, errors = 0;
+	uint64_t exp;
+	int nspans, total;
+	int tfd = -1;
+	int i, j, off;
+
+	nspans = watch_parse(list, spans);
+	if (nspans <= 0)
+		return 1;
+	for (total = 0, i = 0; i < nspans; i++)
+		total += spans[i].len;
+
+	if (rate > 0) {
+		tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (tfd < 0) {
+			perror("timerfd_create");
+			return 1;
+		}
+		its.it_interval.tv_sec = rate == 1;
+		its.it_interval.tv_nsec = rate == 1 ? 0 : 1000000000 / rate;
+		its.it_value = its.it_interval;
+		if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+			perror("timerfd_settime");
+			return 1;
+		}
+	}
+
+	signal(SIGINT, watch_stop);
+	signal(SIGTERM, watch_stop);
+
+	while (watching) {
+		fpga_batch_init(&batch, i2cfd);
+		for (i = 0, off = 0; i < nspans; off += spans[i].len, i++)
+			fpga_batch_peek(&batch, spans[i].addr, &cur[off], spans[i].len);
+		if (fpga_batch_commit(&batch)) {
+			errors++;
+		} else {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			for (i = 0, off = 0; i < nspans; i++) {
+				for (j = 0; j < spans[i].len; j++, off++) {
+					if (samples != 0 && cur[off] == last[off])
+						continue;
+					printf("%ld.%09ld addr%d=0x%X\n", (long)ts.tv_sec, ts.tv_nsec, spans[i].addr + j,
+					       cur[off]);
+				}
+			}
+			memcpy(last, cur, total);
+			samples++;
+			fflush(stdout);
+		}
+
+		if (tfd < 0)
+			continue;
+		if (read(tfd, &exp, sizeof(exp)) != sizeof(exp)) {
+			if (errno == EINTR)
+				continue;
+			perror("timerfd read");
+			break;
+		}
+		/* Every expiration past the first is a sample we did not take */
+		missed += exp - 1;
+	}
+
+	if (tfd >= 0)
+		close(tfd);
+	fprintf(stderr, "samples=%llu missed=%llu errors=%llu\n", (unsigned long long)samples,
+		(unsigned long long)missed, (unsigned long long)errors);
+
+	return errors != 0;
+}
+
 void usage(char **argv)
 {
 	fprintf(stderr,
@@ -573,6 +696,8 @@ void usage(char **argv)
 		"  -m, --addr <address>   Sets up the address for a peek/poke\n"
 		"  -v, --poke <value>     Writes the value to the specified address\n"
 		"  -t, --peek             Reads from the specified address\n"
+		"  -C, --cached <ms>      Used with -t, use the value tshwctld read in\n"
+		"                           the last ms milliseconds if there is one\n"
 		"  -l, --mode <8n1>       Used with -a, sets mode like '8n1', '7e2', etc\n"
 		"  -x, --baud <speed>     Used with -a, sets baud rate for auto485\n"
 		"  -a, --autotxen <uart>  Enables autotxen for supported CPU UARTs\n"
@@ -582,6 +707,16 @@ void usage(char **argv)
 		"  -g, --get              Print crossbar for use in eval\n"
 		"  -s, --set              Read environment for crossbar changes\n"
 		"  -q, --showall          Print all possible FPGA inputs and outputs.\n"
+		"  -S, --save <file>      Save the FPGA registers to an image file\n"
+		"  -R, --restore <file>   Write back registers that differ from an image\n"
+		"  -P, --apply-profile <file>\n"
+		"                         Apply a crossbar profile, either the text\n"
+		"                           or compiled with tscbarc\n"
+		"  -w, --watch <list>     Watch registers like '51,32-43' and print\n"
+		"                           changes with monotonic timestamps\n"
+		"  -r, --rate <hz>        Used with -w, samples per second (default 10,\n"
+		"                           at most 1000), 0 samples as fast as the bus\n"
+		"                           allows\n"
 		"  -h, --help             This message\n"
 		"\n",
 		argv[0]);
@@ -595,36 +730,30 @@ int main(int argc, char **argv)
 	int opt_poke = 0, opt_peek = 0, opt_auto485 = 0;
 	int baud = 0;
 	int model;
+	int opt_cached = -1;
+	char *opt_watch = 0;
+	struct fpga_image img;
+	int ret;
+	int rate = 10;
 	uint8_t pokeval = 0;
 	char *uartmode = 0;
-	struct cbarpin *cbar_inputs, *cbar_outputs;
-	int cbar_size, cbar_mask;
+	const struct cbar_model *cbar;
+	struct cbar_snapshot snap;
+	uint8_t peekval = 0;
+	struct fpga_batch batch;
 
 	static struct option long_options[] = {
 		{ "addr", 1, 0, 'm' }, { "poke", 1, 0, 'v' }, { "peek", 0, 0, 't' },	 { "info", 0, 0, 'i' },
 		{ "baud", 1, 0, 'x' }, { "mode", 1, 0, 'l' }, { "autotxen", 1, 0, 'a' }, { "get", 0, 0, 'g' },
 		{ "set", 0, 0, 's' },  { "dump", 0, 0, 'c' }, { "showall", 0, 0, 'q' },	 { "help", 0, 0, 'h' },
-		{ 0, 0, 0, 0 }
+		{ "cached", 1, 0, 'C' }, { "watch", 1, 0, 'w' }, { "rate", 1, 0, 'r' },	 { "save", 1, 0, 'S' },
+		{ "restore", 1, 0, 'R' }, { "apply-profile", 1, 0, 'P' }, { 0, 0, 0, 0 }
 	};
 
 	i2cfd = fpga_init();
 	model = get_model();
-	if (model == 0x4900) {
-		cbar_inputs = ts4900_inputs;
-		cbar_outputs = ts4900_outputs;
-		cbar_size = 5;
-		cbar_mask = 7;
-	} else if (model == 0x7970) {
-		cbar_inputs = ts7970_inputs;
-		cbar_outputs = ts7970_outputs;
-		cbar_size = 6;
-		cbar_mask = 3;
-	} else if (model == 0x7990) {
-		cbar_inputs = ts7990_inputs;
-		cbar_outputs = ts7990_outputs;
-		cbar_size = 6;
-		cbar_mask = 3;
-	} else {
+	cbar = cbar_get_model(model);
+	if (cbar == NULL) {
 		fprintf(stderr, "Unsupported model %d\n", model);
 		return 1;
 	}
@@ -634,7 +763,7 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	while ((c = getopt_long(argc, argv, "+m:v:il:x:ta:cgsqh", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "+m:v:il:x:ta:cgsqhC:w:r:S:R:P:", long_options, NULL)) != -1) {
 		int i;
 
 		switch (c) {
@@ -655,81 +784,63 @@ int main(int argc, char **argv)
 		case 't':
 			opt_peek = 1;
 			break;
+		case 'C':
+			opt_cached = strtoul(optarg, NULL, 0);
+			break;
 		case 'i':
 			opt_info = 1;
 			break;
+		case 'w':
+			opt_watch = optarg;
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
 		case 'a':
 			opt_auto485 = atoi(optarg);
 			break;
 		case 'g':
-			for (i = 0; cbar_inputs[i].name != 0; i++) {
-				int j;
-				uint8_t mode = fpeek8(i2cfd, cbar_inputs[i].addr) >> (8 - cbar_size);
-				for (j = 0; cbar_outputs[j].name != 0; j++) {
-					if (cbar_outputs[j].addr == mode) {
-						printf("%s=%s\n", cbar_inputs[i].name, cbar_outputs[j].name);
-						break;
-					}
-				}
-			}
+			if (cbar_snapshot_read(i2cfd, cbar, &snap))
+				return 1;
+			cbar_print_get(&snap);
 			break;
 		case 's':
-			for (i = 0; cbar_inputs[i].name != 0; i++) {
-				char *value = getenv(cbar_inputs[i].name);
-				int j;
-				if (value != NULL) {
-					for (j = 0; cbar_outputs[j].name != 0; j++) {
-						if (strcmp(cbar_outputs[j].name, value) == 0) {
-							int mode = cbar_outputs[j].addr;
-							uint8_t val = fpeek8(i2cfd, cbar_inputs[i].addr);
-							fpoke8(i2cfd, cbar_inputs[i].addr,
-							       (mode << (8 - cbar_size)) | (val & cbar_mask));
-
-							break;
-						}
-					}
-					if (cbar_outputs[i].name == 0) {
-						fprintf(stderr, "Invalid value \"%s\" for input %s\n", value,
-							cbar_inputs[i].name);
-					}
-				}
-			}
+			if (cbar_snapshot_read(i2cfd, cbar, &snap))
+				return 1;
+			cbar_set_from_env(&snap);
+			if (cbar_snapshot_write(i2cfd, &snap))
+				return 1;
 			break;
 		case 'c':
-			i = 0;
-			printf("%13s (DIR) (VAL) FPGA Output\n", "FPGA Pad");
-			for (i = 0; cbar_inputs[i].name != 0; i++) {
-				uint8_t value = fpeek8(i2cfd, cbar_inputs[i].addr);
-				uint8_t mode = value >> (8 - cbar_size);
-				char *dir = value & 0x1 ? "out" : "in";
-				int val;
-				int j;
-
-				// 4900 uses 5 bits for cbar, 7970/7990 use 6 and share
-				// the data bit for input/output
-				if (value & 0x1 || cbar_size == 6) {
-					val = value & 0x2 ? 1 : 0;
-				} else {
-					val = value & 0x4 ? 1 : 0;
-				}
-
-				for (j = 0; cbar_outputs[j].name != 0; j++) {
-					if (cbar_outputs[j].addr == mode) {
-						printf("%13s (%3s) (%3d) %s\n", cbar_inputs[i].name, dir, val,
-						       cbar_outputs[j].name);
-						break;
-					}
-				}
+			if (cbar_snapshot_read(i2cfd, cbar, &snap))
+				return 1;
+			cbar_print_dump(&snap);
+			break;
+		case 'S':
+			if (fpga_image_capture(i2cfd, cbar, &img) || fpga_image_save(optarg, &img))
+				return 1;
+			break;
+		case 'R':
+		case 'P':
+			if (c == 'R' ? fpga_image_load(optarg, &img) : cbar_profile_load(optarg, &img))
+				return 1;
+			if (img.model != model) {
+				fprintf(stderr, "%s is from a TS-%X, not a TS-%X\n", optarg, img.model, model);
+				return 1;
 			}
+			ret = fpga_image_restore(i2cfd, &img);
+			if (ret < 0)
+				return 1;
+			printf("%s %d registers from %s\n", c == 'R' ? "Restored" : "Changed", ret, optarg);
 			break;
 		case 'q':
 			printf("FPGA Inputs:\n");
-			for (i = 0; cbar_inputs[i].name != 0; i++) {
-				printf("%s\n", cbar_inputs[i].name);
+			for (i = 0; cbar->inputs[i].name != 0; i++) {
+				printf("%s\n", cbar->inputs[i].name);
 			}
 			printf("\nFPGA Outputs:\n");
-			for (i = 0; cbar_outputs[i].name != 0; i++) {
-				printf("%s\n", cbar_outputs[i].name);
+			for (i = 0; cbar->outputs[i].name != 0; i++) {
+				printf("%s\n", cbar->outputs[i].name);
 			}
 			break;
 		default:
@@ -747,17 +858,27 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (opt_poke) {
-		if (opt_addr) {
-			fpoke8(i2cfd, addr, pokeval);
-		} else {
-			fprintf(stderr, "No address specified\n");
+	if (opt_peek && !opt_poke && opt_addr && opt_cached >= 0) {
+		const struct tshwctld_shm *shm = tshwctld_shm_map();
+
+		if (shm && tshwctld_shm_peek(shm, addr, &peekval, opt_cached * 1000000ULL) == 0) {
+			printf("addr%d=0x%X\n", addr, peekval);
+			opt_peek = 0;
 		}
 	}
 
-	if (opt_peek) {
+	if (opt_poke || opt_peek) {
 		if (opt_addr) {
-			printf("addr%d=0x%X\n", addr, fpeek8(i2cfd, addr));
+			// A poke followed by a peek goes out as one transfer
+			fpga_batch_init(&batch, i2cfd);
+			if (opt_poke)
+				fpga_batch_poke8(&batch, addr, pokeval);
+			if (opt_peek)
+				fpga_batch_peek(&batch, addr, &peekval, 1);
+			if (fpga_batch_commit(&batch))
+				return 1;
+			if (opt_peek)
+				printf("addr%d=0x%X\n", addr, peekval);
 		} else {
 			fprintf(stderr, "No address specified\n");
 		}
@@ -771,6 +892,14 @@ int main(int argc, char **argv)
 		auto485_en(opt_auto485, baud, uartmode);
 	}
 
+	if (opt_watch) {
+		if (rate < 0 || rate > WATCH_MAX_HZ) {
+			fprintf(stderr, "Watch rate must be 0-%d Hz\n", WATCH_MAX_HZ);
+			return 1;
+		}
+		return do_watch(i2cfd, opt_watch, rate);
+	}
+
 	close(i2cfd);
 
 	return 0;
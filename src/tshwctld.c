@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "fpga.h"
+#include "i2cbus.h"
+#include "model.h"
+#include "tshwctld.h"
+
+#define FPGA_ADDR 0x28
+#define MAX_CLIENTS 32
+#define MAX_BUSES 16
+
+struct client {
+	int fd;
+	int busfd;
+	int bus;
+};
+
+static struct client clients[MAX_CLIENTS];
+static int nclients;
+static int busfds[MAX_BUSES];
+static int fpgafd = -1;
+static int model;
+static struct tshwctld_shm *shm;
+static volatile sig_atomic_t running = 1;
+
+static uint8_t reqbuf[sizeof(struct tshwctld_req) + TSHWCTLD_MAX_DATA];
+static uint8_t rspbuf[sizeof(struct tshwctld_rsp) + TSHWCTLD_MAX_DATA];
+
+static void stop(int sig)
+{
+	running = 0;
+}
+
+/* Buses are opened the first time a client asks for them and stay open */
+static int bus_open(int bus)
+{
+	char path[20];
+
+	if (bus == I2CBUS_FPGA) {
+		if (fpgafd == -1)
+			fpgafd = fpga_init();
+		return fpgafd;
+	}
+
+	if (bus < 0 || bus >= MAX_BUSES)
+		return -1;
+
+	if (busfds[bus] == -1) {
+		busfds[bus] = i2cbus_open(bus);
+		if (busfds[bus] < 0) {
+			snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+			perror(path);
+		}
+	}
+
+	return busfds[bus];
+}
+
+static int shm_setup(void)
+{
+	int fd;
+
+	fd = shm_open(TSHWCTLD_SHM, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		perror("shm_open");
+		return -1;
+	}
+
+	if (ftruncate(fd, sizeof(*shm)) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return -1;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	memset(shm, 0, sizeof(*shm));
+	shm->model = model;
+	__atomic_store_n(&shm->magic, TSHWCTLD_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * Record what a completed transfer read in to the shared memory view.  FPGA
+ * register reads are an address write followed by a read, microcontroller
+ * ADC frames are a bare read from offset 0.  An FPGA write is the address
+ * followed by the data, and since a register need not read back what was
+ * written the cached copies of those registers are dropped instead.
+ */
+static void shm_update(struct client *c, struct i2c_msg *msgs, int nmsgs)
+{
+	uint64_t now = tshwctld_now_ns();
+	int i;
+
+	seqlock_write_begin(&shm->seq);
+	for (i = 0; i < nmsgs; i++) {
+		struct i2c_msg *m = &msgs[i];
+
+		if (!(m->flags & I2C_M_RD)) {
+			uint16_t reg;
+			int j;
+
+			if (c->bus != I2CBUS_FPGA || m->addr != FPGA_ADDR || m->len <= 2)
+				continue;
+
+			reg = (m->buf[0] << 8) | m->buf[1];
+			for (j = 0; j < m->len - 2 && reg + j < TSHWCTLD_SHM_REGS; j++)
+				shm->fpga_ns[reg + j] = 0;
+			continue;
+		}
+
+		if (i > 0 && !(msgs[i - 1].flags & I2C_M_RD) && msgs[i - 1].len == 2) {
+			uint16_t reg;
+			int j;
+
+			if (c->bus != I2CBUS_FPGA || m->addr != FPGA_ADDR)
+				continue;
+
+			reg = (msgs[i - 1].buf[0] << 8) | msgs[i - 1].buf[1];
+			for (j = 0; j < m->len && reg + j < TSHWCTLD_SHM_REGS; j++) {
+				shm->fpga_regs[reg + j] = m->buf[j];
+				shm->fpga_ns[reg + j] = now;
+			}
+		} else if (c->bus != I2CBUS_FPGA && (i == 0 || (msgs[i - 1].flags & I2C_M_RD))) {
+			int len = m->len > TSHWCTLD_SHM_FRAME ? TSHWCTLD_SHM_FRAME : m->len;
+
+			memcpy(shm->micro_frame, m->buf, len);
+			shm->micro_len = len;
+			shm->micro_addr = m->addr;
+			shm->micro_ns = now;
+		}
+	}
+	seqlock_write_end(&shm->seq);
+}
+
+static int do_open(struct client *c, struct tshwctld_req *req, struct tshwctld_rsp *rsp)
+{
+	c->busfd = bus_open(req->bus);
+	c->bus = req->bus;
+	if (c->busfd < 0) {
+		rsp->ret = -1;
+		rsp->err = ENODEV;
+	}
+
+	return sizeof(*rsp);
+}
+
+static int do_xfer(struct client *c, struct tshwctld_req *req, int reqlen, struct tshwctld_rsp *rsp)
+{
+	struct i2c_msg msgs[TSHWCTLD_MAX_MSGS];
+	int wlen = 0, rlen = 0;
+	int i;
+
+	if (c->busfd < 0 || req->nmsgs > TSHWCTLD_MAX_MSGS) {
+		rsp->ret = -1;
+		rsp->err = c->busfd < 0 ? EBADF : EINVAL;
+		return sizeof(*rsp);
+	}
+
+	for (i = 0; i < req->nmsgs; i++) {
+		msgs[i].addr = req->msgs[i].addr;
+		msgs[i].flags = req->msgs[i].flags;
+		msgs[i].len = req->msgs[i].len;
+		if (msgs[i].flags & I2C_M_RD) {
+			msgs[i].buf = &rspbuf[sizeof(*rsp) + rlen];
+			rlen += msgs[i].len;
+		} else {
+			msgs[i].buf = &reqbuf[sizeof(*req) + wlen];
+			wlen += msgs[i].len;
+		}
+	}
+
+	if (rlen > TSHWCTLD_MAX_DATA || (int)sizeof(*req) + wlen != reqlen) {
+		rsp->ret = -1;
+		rsp->err = EINVAL;
+		return sizeof(*rsp);
+	}
+
+	rsp->ret = i2cbus_transfer(c->busfd, msgs, req->nmsgs);
+	if (rsp->ret < 0) {
+		rsp->err = errno;
+		return sizeof(*rsp);
+	}
+
+	if (shm)
+		shm_update(c, msgs, req->nmsgs);
+
+	return sizeof(*rsp) + rlen;
+}
+
+/* Returns < 0 when the client should be dropped */
+static int client_request(struct client *c)
+{
+	struct tshwctld_req *req = (struct tshwctld_req *)reqbuf;
+	struct tshwctld_rsp *rsp = (struct tshwctld_rsp *)rspbuf;
+	ssize_t len;
+	int rsplen;
+
+	len = recv(c->fd, reqbuf, sizeof(reqbuf), 0);
+	if (len < (ssize_t)sizeof(*req))
+		return -1;
+
+	memset(rsp, 0, sizeof(*rsp));
+	rsp->model = model;
+
+	switch (req->op) {
+	case TSHWCTLD_OP_OPEN:
+		rsplen = do_open(c, req, rsp);
+		break;
+	case TSHWCTLD_OP_XFER:
+		rsplen = do_xfer(c, req, len, rsp);
+		break;
+	default:
+		rsp->ret = -1;
+		rsp->err = EINVAL;
+		rsplen = sizeof(*rsp);
+	}
+
+	if (send(c->fd, rspbuf, rsplen, MSG_NOSIGNAL) != rsplen)
+		return -1;
+
+	return 0;
+}
+
+static int listen_setup(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 || listen(fd, 8) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] ...\n"
+		"embeddedTS I2C access daemon\n"
+		"\n"
+		"  -n, --noshm            Do not publish registers in shared memory\n"
+		"  -h, --help             This message\n"
+		"\n"
+		"tshwctl, tsmicroctl and isl12020rtc send their I2C transfers through\n"
+		"this daemon when it is running instead of opening the bus themselves.\n"
+		"\n",
+		argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd pfds[MAX_CLIENTS + 1];
+	int opt_shm = 1;
+	int listenfd;
+	int c, i;
+
+	static struct option long_options[] = { { "noshm", no_argument, 0, 'n' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "nh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			opt_shm = 0;
+			break;
+		case 'h':
+			usage(argv);
+			return 0;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	/* The daemon is what actually opens the buses */
+	i2cbus_set_direct(1);
+	for (i = 0; i < MAX_BUSES; i++)
+		busfds[i] = -1;
+
+	model = get_model();
+	if (opt_shm && shm_setup() < 0)
+		return 1;
+
+	listenfd = listen_setup(TSHWCTLD_SOCK);
+	if (listenfd < 0)
+		return 1;
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGPIPE, SIG_IGN);
+
+	while (running) {
+		pfds[0].fd = listenfd;
+		pfds[0].events = POLLIN;
+		for (i = 0; i < nclients; i++) {
+			pfds[i + 1].fd = clients[i].fd;
+			pfds[i + 1].events = POLLIN;
+		}
+
+		if (poll(pfds, nclients + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		/* Walk backwards so dropping a client does not skip another */
+		for (i = nclients - 1; i >= 0; i--) {
+			if (!(pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (client_request(&clients[i]) < 0) {
+				close(clients[i].fd);
+				clients[i] = clients[--nclients];
+			}
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			int fd = accept(listenfd, NULL, NULL);
+
+			if (fd >= 0 && nclients == MAX_CLIENTS) {
+				close(fd);
+			} else if (fd >= 0) {
+				clients[nclients].fd = fd;
+				clients[nclients].busfd = -1;
+				clients[nclients].bus = 0;
+				nclients++;
+			}
+		}
+	}
+
+	close(listenfd);
+	unlink(TSHWCTLD_SOCK);
+	if (shm)
+		shm_unlink(TSHWCTLD_SHM);
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+#ifndef __TSHWCTLD_H_
+#define __TSHWCTLD_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "seqlock.h"
+
+/*
+ * tshwctld owns the I2C buses and runs transfers on behalf of the other
+ * utilities.  Clients talk to it over a SOCK_SEQPACKET unix socket, each
+ * request is one packet and each response is one packet.
+ *
+ * A connection is bound to a bus with TSHWCTLD_OP_OPEN, after which every
+ * TSHWCTLD_OP_XFER carries the same list of messages that would be passed
+ * to I2C_RDWR.  Write data for all messages follows the request header in
+ * order, read data for all messages follows the response header in order.
+ */
+#define TSHWCTLD_SOCK "/run/tshwctld.sock"
+#define TSHWCTLD_SHM "/tshwctld"
+
+#define TSHWCTLD_MAX_MSGS 42
+#define TSHWCTLD_MAX_DATA 8192
+
+#define TSHWCTLD_OP_OPEN 1
+#define TSHWCTLD_OP_XFER 2
+
+struct tshwctld_msg {
+	uint16_t addr;
+	uint16_t flags;
+	uint16_t len;
+};
+
+struct tshwctld_req {
+	uint32_t op;
+	int32_t bus;
+	uint32_t nmsgs;
+	struct tshwctld_msg msgs[TSHWCTLD_MAX_MSGS];
+};
+
+struct tshwctld_rsp {
+	int32_t ret; /* Same as the I2C_RDWR return value */
+	int32_t err; /* errno if ret < 0 */
+	int32_t model;
+};
+
+/*
+ * Shared memory view of registers the daemon has recently read.  Updated by
+ * the daemon under the seqlock, so readers get consistent values without
+ * any syscalls.  Timestamps are CLOCK_MONOTONIC in ns, 0 if never read.
+ */
+#define TSHWCTLD_SHM_MAGIC 0x54534857
+#define TSHWCTLD_SHM_REGS 256
+#define TSHWCTLD_SHM_FRAME 64
+
+struct tshwctld_shm {
+	uint32_t magic;
+	uint32_t seq;
+	int32_t model;
+	uint64_t fpga_ns[TSHWCTLD_SHM_REGS];
+	uint8_t fpga_regs[TSHWCTLD_SHM_REGS];
+	uint64_t micro_ns;
+	uint16_t micro_addr;
+	uint16_t micro_len;
+	uint8_t micro_frame[TSHWCTLD_SHM_FRAME];
+};
+
+static inline uint64_t tshwctld_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Returns the mapped segment, or NULL if the daemon is not running */
+static inline const struct tshwctld_shm *tshwctld_shm_map(void)
+{
+	const struct tshwctld_shm *shm;
+	int fd;
+
+	fd = shm_open(TSHWCTLD_SHM, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED || shm->magic != TSHWCTLD_SHM_MAGIC)
+		return NULL;
+
+	return shm;
+}
+
+/* Returns 0 and the register value if it was read in the last maxage_ns,
+ * -1 otherwise */
+static inline int tshwctld_shm_peek(const struct tshwctld_shm *shm, uint16_t addr, uint8_t *val, uint64_t maxage_ns)
+{
+	uint64_t stamp;
+	uint32_t seq;
+
+	if (addr >= TSHWCTLD_SHM_REGS)
+		return -1;
+
+	do {
+		if (seqlock_read_begin(&shm->seq, &seq) < 0)
+			return -1;
+		stamp = shm->fpga_ns[addr];
+		*val = shm->fpga_regs[addr];
+	} while (seqlock_read_retry(&shm->seq, seq));
+
+	if (stamp == 0 || tshwctld_now_ns() - stamp > maxage_ns)
+		return -1;
+
+	return 0;
+}
+
+/* Copies the last microcontroller frame read from i2caddr.  Returns the
+ * number of bytes copied, or -1 if there is none newer than maxage_ns. */
+static inline int tshwctld_shm_micro(const struct tshwctld_shm *shm, uint16_t i2caddr, uint8_t *data, int len,
+				     uint64_t maxage_ns)
+{
+	uint64_t stamp;
+	uint16_t addr, n;
+	uint32_t seq;
+
+	do {
+		if (seqlock_read_begin(&shm->seq, &seq) < 0)
+			return -1;
+		stamp = shm->micro_ns;
+		addr = shm->micro_addr;
+		n = shm->micro_len;
+		if (n > len)
+			n = len;
+		memcpy(data, shm->micro_frame, n);
+	} while (seqlock_read_retry(&shm->seq, seq));
+
+	if (stamp == 0 || addr != i2caddr || tshwctld_now_ns() - stamp > maxage_ns)
+		return -1;
+
+	return n;
+}
+
+#endif
@@ -14,70 +14,37 @@
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include "micro.h"
+#include "microadc.h"
+#include "microcal.h"
+#include "microlog.h"
+#include "microsched.h"
+#include "microshm.h"
+#include "microstream.h"
+#include "microtrig.h"
+#include "model.h"
 
 int model = 0;
 int i2cdevaddr;
+int cached_ms = -1;
 
-static int get_model()
+/* The first 32 bytes of the frame, from a running --publish sampler if
+ * there is a new enough sample and -C was given, or from the bus */
+static int read_frame(int i2cfd, uint8_t *frame)
 {
-	int fd;
-	char mdl[256] = { 0 }; // Ensure the buffer is zero-initialized
-	char *ptr;
-	ssize_t ret;
-
-	// Open the model file using open system call
-	fd = open("/proc/device-tree/model", O_RDONLY);
-	if (fd < 0) {
-		perror("model");
-		return 0;
-	}
-
-	// Read the contents of the model file
-	ret = read(fd, mdl, sizeof(mdl) - 1); // Read up to 255 bytes
-	close(fd); // Close the file after reading
-
-	if (ret < 0) {
-		perror("read");
-		return 0;
-	}
-
-	// Null-terminate the string
-	mdl[ret] = '\0';
-
-	// Find the "TS-" substring
-	ptr = strstr(mdl, "TS-");
-	if (!ptr) {
-		fprintf(stderr, "Unsupported model: %s\n", mdl);
-		return 0;
+	static const struct microshm *shm;
+	struct microshm_sample s;
+
+	if (cached_ms >= 0) {
+		/* Mapped once, a sampler started later is not picked up */
+		if (shm == NULL)
+			shm = microshm_map();
+		if (shm && shm->model == model && microshm_latest(shm, &s, cached_ms * 1000000ULL) == 0) {
+			memcpy(frame, s.frame, MICROSHM_FRAME);
+			return 0;
+		}
 	}
 
-	// Convert the number after "TS-" to a hexadecimal value
-	return (int)strtoul(ptr + 3, NULL, 16);
-}
-
-// Scale voltage to microcontroller 0-2.5V
-static uint16_t inline sscale(uint16_t data)
-{
-	return data * (2.5 / 1023) * 1000;
-}
-
-// Scale voltage for resistor dividers
-static uint16_t inline rscale(uint16_t data, uint16_t r1, uint16_t r2)
-{
-	uint16_t ret = (data * (r1 + r2) / r2);
-	return sscale(ret);
-}
-
-// Scale for 0-20mA current loop
-// shunt in ohms
-static uint16_t inline cscale(uint16_t data, uint16_t shunt)
-{
-	uint32_t ret = sscale(data);
-	// Scale to microamps
-	ret *= 1000;
-	ret /= shunt;
-
-	return (uint16_t)ret;
+	return v0_stream_read(i2cfd, i2cdevaddr, frame, 32);
 }
 
 static int do_sleep(int i2cfd, int seconds)
@@ -126,102 +93,266 @@ static int do_sleep(int i2cfd, int seconds)
 	return 0;
 }
 
-static uint16_t swap_byte_order(uint16_t value)
+/* Every channel the model has in the frame, in mV or uA */
+static void print_adc(const uint8_t *frame)
 {
-	return (value >> 8) | (value << 8);
+	const struct micro_adc_model *adc = microcal_get_model(model);
+	uint32_t val[MICRO_ADC_CHANS];
+	int i;
+
+	micro_adc_convert(adc, frame, 0, 1, val);
+	for (i = 0; i < adc->nchans; i++) {
+		if (adc->chans[i].hex)
+			printf("%s=0x%X\n", adc->chans[i].name, val[i]);
+		else
+			printf("%s=%d\n", adc->chans[i].name, val[i]);
+	}
 }
 
 static int do_ts7990_info(int i2cfd)
 {
-	uint16_t data[16];
-	int i;
+	uint8_t frame[32];
 
-	if (v0_stream_read(i2cfd, i2cdevaddr, (uint8_t *)data, 32) < 0) {
+	if (read_frame(i2cfd, frame) < 0) {
 		fprintf(stderr, "I2C Read failed\n");
 		return -1;
 	}
-	for (i = 0; i <= 10; i++)
-		data[i] = swap_byte_order(data[i]);
-
-	printf("VIN=%d\n", rscale(data[0], 2870, 147));
-	printf("V5_A=%d\n", rscale(data[1], 147, 107));
-	printf("AN_LCD_20V=%d\n", rscale(data[2], 121, 1));
-	printf("DDR_1P5V=%d\n", sscale(data[3]));
-	printf("V1P8=%d\n", sscale(data[4]));
-	printf("SUPERCAP=%d\n", rscale(data[5], 100, 22));
-	printf("SUPERCAP_PCT=%d\n", (rscale(data[5], 100, 22) * 100) / 12000);
-	printf("BACK_LT_RAW=0x%X\n", rscale(data[6], 2870, 147));
-	printf("V3P3=%d\n", rscale(data[7], 499, 499));
-	printf("VDD_ARM_CAP=%d\n", sscale(data[8]));
-	printf("VDD_SOC_CAP=%d\n", sscale(data[9]));
-	printf("MICROREV=%d\n", data[15] >> 8);
+
+	print_adc(frame);
+	printf("SUPERCAP_PCT=%d\n", ts7990_supercap_pct(micro_adc_raw(frame, TS7990_SUPERCAP_CHAN)));
+	printf("MICROREV=%d\n", frame[31]);
 
 	return 0;
 }
 
 static int do_ts7970_info(int i2cfd)
 {
-	uint16_t data[19];
-	int i;
+	uint8_t frame[38];
+	uint16_t rev;
+	int cached_rev;
 
 	/* Rev 6 marks the change from Silicon Labs parts to Renesas for the
 	 * microcontroller. This change adds support for MAC address in the uC
 	 * which adds extra bytes to what are read.
 	 *
-	 * To correctly handle the differences, we need to read an amount of
-	 * data that matches the lowest common denominator, 32 bytes on uC rev
-	 * <= 5.
-	 *
-	 * Later, if we check and find that the rev is >= 6, then we can re-read
-	 * the data to get the full 38 bytes which includes the MAC address on the
-	 * newer microcontroller revisions.
 	 * To correctly handle errors, we need to have read 38 bytes if rev is
 	 * >= 6, and 32 bytes for rev <= 5. Anything other than that should be
 	 * considered a failure.
+	 *
+	 * The rev is normally known from micro_get_rev() already, so on rev >= 6
+	 * the whole 38 bytes are read at once.  Otherwise read the 32 bytes
+	 * every rev has and, if the rev turns out to be >= 6, just the MAC
+	 * after them.
 	 */
-	if (v0_stream_read(i2cfd, i2cdevaddr, (uint8_t *)data, 32) < 0) {
+	cached_rev = micro_get_rev(i2cfd, i2cdevaddr, model);
+	if (cached_rev >= 6 && cached_ms < 0) {
+		if (v0_stream_read(i2cfd, i2cdevaddr, frame, 38) < 0) {
+			fprintf(stderr, "I2C Read failed\n");
+			return -1;
+		}
+	} else if (read_frame(i2cfd, frame) < 0) {
 		fprintf(stderr, "I2C Read failed\n");
 		return -1;
 	}
 
-	for (i = 0; i <= 16; i++)
-		data[i] = swap_byte_order(data[i]);
-
-	printf("VDD_ARM_CAP=%d\n", sscale(data[0]));
-	printf("VDD_HIGH_CAP=%d\n", sscale(data[1]));
-	printf("VDD_SOC_CAP=%d\n", sscale(data[2]));
-	printf("VDD_ARM=%d\n", sscale(data[3]));
-	printf("P10_RAW=0x%X\n", data[4]);
-	printf("P11_RAW=0x%X\n", data[5]);
-	printf("P12_RAW=0x%X\n", data[6]);
-	printf("VIN=%d\n", rscale(data[7], 2870, 147));
-	printf("V5_A=%d\n", rscale(data[8], 147, 107));
-	printf("V3P1=%d\n", rscale(data[9], 499, 499));
-	printf("DDR_1P5V=%d\n", sscale(data[10]));
-	printf("V1P8=%d\n", sscale(data[11]));
-	printf("V1P2=%d\n", sscale(data[12]));
-	printf("RAM_VREF=%d\n", sscale(data[13]));
-	printf("V3P3=%d\n", rscale(data[14], 499, 499));
-	printf("MICROREV=%d\n", data[15]);
-
-	printf("P10_UA=%d\n", cscale(data[4], 110));
-	printf("P11_UA=%d\n", cscale(data[5], 110));
-	printf("P12_UA=%d\n", cscale(data[6], 110));
-	if (data[15] >= 6) {
-		if (v0_stream_read(i2cfd, i2cdevaddr, (uint8_t *)data, 38) < 0) {
+	print_adc(frame);
+	printf("P10_RAW=0x%X\n", micro_adc_raw(frame, 4));
+	printf("P11_RAW=0x%X\n", micro_adc_raw(frame, 5));
+	printf("P12_RAW=0x%X\n", micro_adc_raw(frame, 6));
+	rev = micro_adc_raw(frame, 15);
+	printf("MICROREV=%d\n", rev);
+
+	if (rev >= 6) {
+		if (!(cached_rev >= 6 && cached_ms < 0) &&
+		    micro_read(i2cfd, i2cdevaddr, micro_addressed(model, rev), 32, &frame[32], 6) < 0 &&
+		    v0_stream_read(i2cfd, i2cdevaddr, frame, 38) < 0) {
 			fprintf(stderr, "MAC read failed\n");
 			return -1;
 		}
-		// MAC is stored starting at offset 16
-		uint8_t *mac_bytes = (uint8_t *)&data[16];
+		// MAC is stored starting at offset 32
 		printf("MAC=\"%02x:%02x:%02x:%02x:%02x:%02x\"\n",
-			mac_bytes[1], mac_bytes[0], mac_bytes[3],
-			mac_bytes[2], mac_bytes[5], mac_bytes[4]);
+			frame[33], frame[32], frame[35],
+			frame[34], frame[37], frame[36]);
+	}
+
+	return 0;
+}
+
+/*
+ * Prints just the channels in list, like VIN,SUPERCAP, from one read that
+ * covers them.  On microcontrollers that take a register address the read
+ * starts at the first of them, so a single rail is a 2 byte read.
+ */
+static int do_channels(int i2cfd, const char *list)
+{
+	const struct micro_adc_model *adc = microcal_get_model(model);
+	uint8_t frame[32] = { 0 };
+	uint32_t val[MICRO_ADC_CHANS];
+	const char *p = list;
+	int first = MICRO_ADC_CHANS, last = -1, off = 0;
+	int chans[MICRO_ADC_CHANS * 2];
+	int n = 0, len, c, i, rev;
+
+	while (*p && n < MICRO_ADC_CHANS * 2) {
+		len = strcspn(p, ",");
+		c = micro_adc_find(adc, p, len);
+		if (c < 0) {
+			fprintf(stderr, "No channel %.*s on this model\n", len, p);
+			return -1;
+		}
+		chans[n++] = c;
+		if (c < first)
+			first = c;
+		if (c > last)
+			last = c;
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+	if (n == 0)
+		return -1;
+
+	if (cached_ms >= 0 && read_frame(i2cfd, frame) == 0) {
+		/* Already in shared memory */
+	} else {
+		rev = micro_get_rev(i2cfd, i2cdevaddr, model);
+		if (micro_addressed(model, rev))
+			off = first * 2;
+		if (micro_read(i2cfd, i2cdevaddr, micro_addressed(model, rev), off, &frame[off], (last + 1) * 2 - off) < 0) {
+			fprintf(stderr, "I2C Read failed\n");
+			return -1;
+		}
+	}
+
+	micro_adc_convert(adc, frame, 0, 1, val);
+	for (i = 0; i < n; i++) {
+		c = chans[i];
+		if (adc->chans[c].hex)
+			printf("%s=0x%X\n", adc->chans[c].name, val[c]);
+		else
+			printf("%s=%d\n", adc->chans[c].name, val[c]);
+	}
+
+	return 0;
+}
+
+/*
+ * Averages frames while the references in list, like P10_UA=4000, are
+ * applied and adds each as a calibration point for its channel
+ */
+static int do_calibrate(int i2cfd, const char *list, int rate, uint64_t frames)
+{
+	const struct micro_adc_model *adc = micro_adc_get_model(model);
+	uint32_t mean_q8[MICRO_ADC_CHANS];
+	int chans[MICRO_ADC_CHANS];
+	long refs[MICRO_ADC_CHANS];
+	struct microcal cal;
+	const char *p;
+	char *end;
+	int len, c, i, n = 0;
+
+	/* Check the whole list before spending time averaging */
+	for (p = list; *p && n < MICRO_ADC_CHANS; p = *end ? end + 1 : end) {
+		len = strcspn(p, "=");
+		c = micro_adc_find(adc, p, len);
+		if (c < 0 || p[len] != '=') {
+			fprintf(stderr, "%s: expected CHAN=value with a channel on this model\n", p);
+			return -1;
+		}
+		refs[n] = strtol(p + len + 1, &end, 0);
+		if (end == p + len + 1 || (*end != ',' && *end != 0)) {
+			fprintf(stderr, "%.*s: bad value\n", len, p);
+			return -1;
+		}
+		chans[n++] = c;
+	}
+
+	microcal_load(&cal, model);
+	fprintf(stderr, "Averaging %llu frames\n", (unsigned long long)frames);
+	if (micro_average(i2cfd, i2cdevaddr, rate, frames, mean_q8)) {
+		fprintf(stderr, "Calibration interrupted, nothing saved\n");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		c = chans[i];
+		if (microcal_add_point(&cal, adc, c, mean_q8[c], refs[i]) < 0)
+			return -1;
+		printf("%s_CAL_POINTS=%u\n", adc->chans[c].name, cal.chan[c].npoints);
+		printf("%s_CAL_GAIN=%.5f\n", adc->chans[c].name, (double)cal.chan[c].gain / adc->gain[c]);
+		printf("%s_CAL_OFFSET=%.1f\n", adc->chans[c].name, (double)cal.chan[c].bias / (1 << MICRO_ADC_SHIFT));
+	}
+
+	return microcal_save(&cal);
+}
+
+/* Window length as a key suffix, 1S, 1M, 1H */
+static void window_name(char *buf, int len, uint32_t seconds)
+{
+	if (seconds % 3600 == 0)
+		snprintf(buf, len, "%uH", seconds / 3600);
+	else if (seconds % 60 == 0)
+		snprintf(buf, len, "%uM", seconds / 60);
+	else
+		snprintf(buf, len, "%uS", seconds);
+}
+
+static int do_stats(void)
+{
+	const struct microshm *shm = microshm_map();
+	struct microshm_window w;
+	char win[16];
+	int i, c;
+
+	if (shm == NULL || shm->model != model) {
+		fprintf(stderr, "No tsmicroctl --publish sampler is running\n");
+		return -1;
+	}
+
+	/* A sampler killed mid-update leaves no statistics to read */
+	if (microshm_stats(shm, 0, &w) < 0) {
+		fprintf(stderr, "No tsmicroctl --publish sampler is running\n");
+		return -1;
+	}
+
+	for (i = 0; microshm_stats(shm, i, &w) == 0; i++) {
+		window_name(win, sizeof(win), w.seconds);
+		printf("SAMPLES_%s=%llu\n", win, (unsigned long long)w.n);
+		if (w.n == 0)
+			continue;
+		for (c = 0; c < (int)shm->nchans; c++) {
+			const struct microshm_stat *st = &w.stat[c];
+			const char *name = shm->name[c];
+
+			printf("%s_%s_MIN=%d\n", name, win, st->min);
+			printf("%s_%s_MAX=%d\n", name, win, st->max);
+			printf("%s_%s_MEAN=%.0f\n", name, win, st->mean);
+			printf("%s_%s_STDDEV=%.1f\n", name, win, st->stddev);
+			printf("%s_%s_P1=%d\n", name, win, st->p1);
+			printf("%s_%s_P99=%d\n", name, win, st->p99);
+		}
 	}
 
 	return 0;
 }
 
+/* Parses a list of window lengths in seconds like "1,60,3600" */
+static int parse_windows(char *list, int *windows)
+{
+	char *tok, *save;
+	int n = 0;
+
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (n == MICROSHM_WINDOWS || atoi(tok) < 1) {
+			fprintf(stderr, "Expected up to %d window lengths in seconds\n", MICROSHM_WINDOWS);
+			return -1;
+		}
+		windows[n++] = atoi(tok);
+	}
+
+	return n;
+}
+
 static unsigned char const crc8x_table[] = {
 	0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D, 0x70, 0x77,
 	0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D, 0xE0, 0xE7, 0xEE, 0xE9,
@@ -312,9 +443,46 @@ static void usage(char **argv)
 		"\n"
 		"  -h, --help            This message\n"
 		"  -i, --info            Read all microcontroller ADC values and rev\n"
+		"  -c, --channels <list> Read just these ADC channels, like VIN,SUPERCAP\n"
+		"  -C, --cached <ms>     Used with -i or -c, use the values a --publish sampler\n"
+		"                          read in the last ms milliseconds if there are any\n"
 		"  -s, --sleep <seconds> Put the board in a sleep mode for n seconds\n"
+		"  -k, --calibrate <list>\n"
+		"                        Average frames while the values in list, like\n"
+		"                          P10_UA=4000,VIN=12000, are applied and calibrate\n"
+		"                          those channels.  -S and -n set the rate and\n"
+		"                          frames (default 100 Hz, %d frames)\n"
+		"  -S, --stream <hz>     Write raw ADC frames as a binary stream\n"
+		"  -o, --output <file>   Used with -S, write to file instead of stdout\n"
+		"  -n, --count <n>       Used with -S, stop after n samples, or n\n"
+		"                          captures with -t\n"
+		"  -L, --log <dir>       Used with -S, keep a compact log of raw frames in\n"
+		"                          dir for tsmicrolog to read back\n"
+		"  -F, --flush <s>       Used with -L, write to flash every s seconds\n"
+		"                          (default %d)\n"
+		"  -G, --segments <n>    Used with -L, segment files kept, each %d KiB\n"
+		"                          (default %d)\n"
+		"  -D, --decimate <n>    Used with -S, print every channel averaged over\n"
+		"                          blocks of n samples instead, for more resolution\n"
+		"  -O, --order <n>       Used with -D, CIC filter order 1-4 (default 1, a\n"
+		"                          plain average)\n"
+		"  -t, --trigger <cond>  Used with -S and -o, capture samples around\n"
+		"                          cond, like VIN<11000, SUPERCAP:slope<-500 or\n"
+		"                          V5_A:dip>200.  Can be given more than once\n"
+		"  -b, --pre <n>         Used with -t, samples kept before the trigger\n"
+		"                          (default 100)\n"
+		"  -a, --post <n>        Used with -t, samples taken after the trigger\n"
+		"                          (default 100)\n"
+		"  -R, --rates <list>    Read each channel at its own rate, like\n"
+		"                          SUPERCAP=50,VIN=50,V1P2=0.1, reading no more\n"
+		"                          of the frame than needed.  -n stops after n reads\n"
+		"  -P, --publish <hz>    Sample continuously and publish the values in\n"
+		"                          shared memory for -C and other readers\n"
+		"  -W, --windows <list>  Used with -P, windows in seconds to keep rolling\n"
+		"                          statistics over (default 1,60,3600)\n"
+		"  -T, --stats           Print the rolling statistics from a -P sampler\n"
 		"    All values are returned in mV unless otherwise labeled\n\n",
-		argv[0]);
+		argv[0], MICROCAL_FRAMES, MICROLOG_FLUSH_S, MICROLOG_SEG_BLOCKS * MICROLOG_BLOCK / 1024, MICROLOG_SEGS);
 }
 
 int main(int argc, char **argv)
@@ -325,10 +493,48 @@ int main(int argc, char **argv)
 	int print_info = 0;
 	int enter_sleep = 0;
 	int set_mac = 0;
+	int stream_rate = 0;
+	int publish_rate = 0;
+	int windows[MICROSHM_WINDOWS] = { 1, 60, 3600 };
+	int nwindows = 3;
+	int print_stats = 0;
+	struct microtrig trigs[8];
+	char *trig_exprs[8];
+	int ntrigs = 0;
+	int pre = 100, post = 100;
+	int decimate = 0, order = 1;
+	struct microsched sched;
+	char *rates = NULL;
+	char *channels = NULL;
+	char *logdir = NULL;
+	char *calibrate = NULL;
+	int flush_s = MICROLOG_FLUSH_S, nsegs = MICROLOG_SEGS;
+	int i;
+	uint64_t stream_count = 0;
+	char *output = NULL;
+	int outfd = STDOUT_FILENO;
 
 	static struct option long_options[] = { { "info", no_argument, 0, 'i' },
+						{ "channels", required_argument, 0, 'c' },
+						{ "calibrate", required_argument, 0, 'k' },
 						{ "sleep", required_argument, 0, 's' },
 						{ "mac", required_argument, 0, 'm' },
+						{ "stream", required_argument, 0, 'S' },
+						{ "output", required_argument, 0, 'o' },
+						{ "count", required_argument, 0, 'n' },
+						{ "rates", required_argument, 0, 'R' },
+						{ "publish", required_argument, 0, 'P' },
+						{ "cached", required_argument, 0, 'C' },
+						{ "windows", required_argument, 0, 'W' },
+						{ "stats", no_argument, 0, 'T' },
+						{ "log", required_argument, 0, 'L' },
+						{ "flush", required_argument, 0, 'F' },
+						{ "segments", required_argument, 0, 'G' },
+						{ "decimate", required_argument, 0, 'D' },
+						{ "order", required_argument, 0, 'O' },
+						{ "trigger", required_argument, 0, 't' },
+						{ "pre", required_argument, 0, 'b' },
+						{ "post", required_argument, 0, 'a' },
 						{ "help", 0, 0, 'h' },
 						{ 0, 0, 0, 0 } };
 
@@ -351,11 +557,17 @@ int main(int argc, char **argv)
 	if (i2cfd < 0)
 		return 1;
 
-	while ((c = getopt_long(argc, argv, "is:m:h", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "ic:k:s:m:S:o:n:R:P:C:W:TL:F:G:D:O:t:b:a:h", long_options, NULL)) != -1) {
 		switch (c) {
 		case 'i':
 			print_info = 1;
 			break;
+		case 'c':
+			channels = optarg;
+			break;
+		case 'k':
+			calibrate = optarg;
+			break;
 		case 's':
 			enter_sleep = atoi(optarg);
 			if (enter_sleep < 1) {
@@ -368,6 +580,80 @@ int main(int argc, char **argv)
 			set_mac = 1;
 			macptr = optarg;
 			break;
+		case 'S':
+			stream_rate = atoi(optarg);
+			if (stream_rate < 1 || stream_rate > 1000) {
+				fprintf(stderr, "Stream rate must be 1-1000 Hz\n");
+				return 1;
+			}
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'R':
+			rates = optarg;
+			break;
+		case 'P':
+			publish_rate = atoi(optarg);
+			if (publish_rate < 1 || publish_rate > 1000) {
+				fprintf(stderr, "Publish rate must be 1-1000 Hz\n");
+				return 1;
+			}
+			break;
+		case 'C':
+			cached_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'W':
+			nwindows = parse_windows(optarg, windows);
+			if (nwindows < 1)
+				return 1;
+			break;
+		case 'T':
+			print_stats = 1;
+			break;
+		case 'L':
+			logdir = optarg;
+			break;
+		case 'F':
+			flush_s = atoi(optarg);
+			if (flush_s < 1) {
+				fprintf(stderr, "Flush interval must be at least 1 second\n");
+				return 1;
+			}
+			break;
+		case 'G':
+			nsegs = atoi(optarg);
+			if (nsegs < 2) {
+				fprintf(stderr, "At least 2 segments are needed\n");
+				return 1;
+			}
+			break;
+		case 'D':
+			decimate = atoi(optarg);
+			if (decimate < 1) {
+				fprintf(stderr, "Decimation ratio must be at least 1\n");
+				return 1;
+			}
+			break;
+		case 'O':
+			order = atoi(optarg);
+			break;
+		case 't':
+			if (ntrigs == (int)(sizeof(trigs) / sizeof(trigs[0]))) {
+				fprintf(stderr, "Too many triggers\n");
+				return 1;
+			}
+			trig_exprs[ntrigs++] = optarg;
+			break;
+		case 'b':
+			pre = atoi(optarg);
+			break;
+		case 'a':
+			post = atoi(optarg);
+			break;
+		case 'n':
+			stream_count = strtoull(optarg, NULL, 0);
+			break;
 		case 'h':
 			usage(argv);
 			return 0;
@@ -395,5 +681,64 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (calibrate) {
+		if (do_calibrate(i2cfd, calibrate, stream_rate ? stream_rate : 100,
+				 stream_count ? stream_count : MICROCAL_FRAMES) < 0)
+			return 1;
+		return 0;
+	}
+
+	if (channels)
+		if (do_channels(i2cfd, channels) < 0)
+			return 1;
+
+	if (stream_rate && ntrigs) {
+		if (output == NULL || pre < 0 || post < 0) {
+			usage(argv);
+			return 1;
+		}
+		for (i = 0; i < ntrigs; i++) {
+			if (microtrig_parse(&trigs[i], microcal_get_model(model), trig_exprs[i]) < 0)
+				return 1;
+		}
+		if (micro_capture(i2cfd, i2cdevaddr, model, stream_rate, trigs, ntrigs, pre, post, output,
+				  stream_count))
+			return 1;
+	} else if (stream_rate && logdir) {
+		if (micro_log(i2cfd, i2cdevaddr, model, stream_rate, logdir, nsegs, flush_s, stream_count))
+			return 1;
+	} else if (stream_rate && decimate) {
+		if (micro_decimate(i2cfd, i2cdevaddr, model, stream_rate, decimate, order, stream_count))
+			return 1;
+	} else if (stream_rate) {
+		if (output) {
+			outfd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (outfd < 0) {
+				perror(output);
+				return 1;
+			}
+		} else if (isatty(outfd)) {
+			fprintf(stderr, "Not writing a binary stream to a terminal, use -o\n");
+			return 1;
+		}
+		if (micro_stream(i2cfd, i2cdevaddr, model, stream_rate, outfd, stream_count))
+			return 1;
+	}
+
+	if (rates) {
+		if (microsched_parse(&sched, microcal_get_model(model), rates) < 0)
+			return 1;
+		sched.addressed = micro_addressed(model, micro_get_rev(i2cfd, i2cdevaddr, model));
+		if (micro_schedule(i2cfd, i2cdevaddr, &sched, stream_count))
+			return 1;
+	}
+
+	if (print_stats)
+		if (do_stats() < 0)
+			return 1;
+
+	if (publish_rate)
+		return micro_publish(i2cfd, i2cdevaddr, model, publish_rate, windows, nwindows);
+
 	return 0;
 }
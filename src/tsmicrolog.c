@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "microadc.h"
+#include "microcal.h"
+#include "microlog.h"
+
+/* One intact block found in the log */
+struct entry {
+	uint64_t seq;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	int fd;
+	int idx;
+};
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* Seconds since the epoch, or before now if negative */
+static uint64_t parse_time(const char *arg)
+{
+	double t = strtod(arg, NULL);
+
+	if (t < 0)
+		t += time(NULL);
+	return t < 0 ? 0 : t * 1e9;
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] <dir>\n"
+		"embeddedTS microcontroller ADC log reader\n"
+		"\n"
+		"  -f, --from <time>      First sample to print, in seconds since the\n"
+		"                           epoch or, if negative, before now\n"
+		"  -t, --to <time>        Last sample to print, the same way\n"
+		"  -c, --channels <list>  Only print these channels, like VIN,SUPERCAP\n"
+		"  -r, --raw              Print raw ADC codes instead of mV\n"
+		"  -h, --help             This message\n"
+		"\n"
+		"Reads a log written by \"tsmicroctl --stream <hz> --log <dir>\" and\n"
+		"prints one line per sample, oldest first.\n"
+		"\n",
+		argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	static uint64_t buf[MICROLOG_BLOCK / sizeof(uint64_t)];
+	uint8_t *block = (uint8_t *)buf;
+	const struct microlog_hdr *h = (const struct microlog_hdr *)buf;
+	const struct micro_adc_model *adc = NULL;
+	struct microlog_iter it;
+	struct entry *ents = NULL;
+	struct dirent *de;
+	uint64_t from = 0, to = UINT64_MAX;
+	uint32_t val;
+	uint16_t want = 0xffff;
+	char *channels = NULL;
+	char path[4096];
+	int nents = 0, maxents = 0;
+	int raw = 0;
+	int c, i, n, seg, fd, len, nblocks;
+	struct stat st;
+	DIR *d;
+
+	static struct option long_options[] = { { "from", required_argument, 0, 'f' },
+						{ "to", required_argument, 0, 't' },
+						{ "channels", required_argument, 0, 'c' },
+						{ "raw", no_argument, 0, 'r' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "f:t:c:rh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			from = parse_time(optarg);
+			break;
+		case 't':
+			to = parse_time(optarg);
+			break;
+		case 'c':
+			channels = optarg;
+			break;
+		case 'r':
+			raw = 1;
+			break;
+		case 'h':
+			usage(argv);
+			return 0;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv);
+		return 1;
+	}
+
+	d = opendir(argv[optind]);
+	if (d == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	/* Index every intact block in the time range, the ring order is lost
+	 * across segments so they are put back in order by seq */
+	while ((de = readdir(d)) != NULL) {
+		if (sscanf(de->d_name, "seg%d.tsl", &seg) != 1)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", argv[optind], de->d_name);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			perror(path);
+			continue;
+		}
+		nblocks = fstat(fd, &st) == 0 ? st.st_size / MICROLOG_BLOCK : 0;
+		for (i = 0; i < nblocks; i++) {
+			/* Torn by a power loss, or never finished */
+			if (microlog_read_block(fd, i, block) < 0)
+				continue;
+			if (h->last_ns < from || h->first_ns > to)
+				continue;
+			if (adc == NULL)
+				adc = microcal_get_model(h->model);
+			if (nents == maxents) {
+				maxents = maxents ? maxents * 2 : 256;
+				ents = realloc(ents, maxents * sizeof(*ents));
+				if (ents == NULL) {
+					perror("realloc");
+					return 1;
+				}
+			}
+			ents[nents].seq = h->seq;
+			ents[nents].first_ns = h->first_ns;
+			ents[nents].last_ns = h->last_ns;
+			ents[nents].fd = fd;
+			ents[nents].idx = i;
+			nents++;
+		}
+	}
+	closedir(d);
+
+	if (nents == 0)
+		return 0;
+	if (adc == NULL) {
+		fprintf(stderr, "Log is from an unknown model\n");
+		return 1;
+	}
+
+	if (channels) {
+		want = 0;
+		while (*channels) {
+			len = strcspn(channels, ",");
+			c = micro_adc_find(adc, channels, len);
+			if (c < 0) {
+				fprintf(stderr, "No channel %.*s on this model\n", len, channels);
+				return 1;
+			}
+			want |= 1 << c;
+			channels += len;
+			if (*channels == ',')
+				channels++;
+		}
+	}
+
+	qsort(ents, nents, sizeof(*ents), entry_cmp);
+	for (n = 0; n < nents; n++) {
+		if (microlog_read_block(ents[n].fd, ents[n].idx, block) < 0)
+			continue;
+		microlog_iter_init(&it, block);
+		while (microlog_iter_next(&it)) {
+			if (it.ns < from || it.ns > to)
+				continue;
+			printf("%llu.%09llu", (unsigned long long)(it.ns / 1000000000),
+			       (unsigned long long)(it.ns % 1000000000));
+			for (c = 0; c < adc->nchans && c < it.nchans; c++) {
+				if (!(want & (1 << c)))
+					continue;
+				val = raw || adc->chans[c].hex ? it.raw[c] : micro_adc_value(adc, c, it.raw[c]);
+				if (adc->chans[c].hex && !raw)
+					printf(" %s=0x%X", adc->chans[c].name, val);
+				else
+					printf(" %s=%u", adc->chans[c].name, val);
+			}
+			printf("\n");
+		}
+	}
+
+	return 0;
+}
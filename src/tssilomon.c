@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <limits.h>
+#include <gpiod.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "capfit.h"
+#include "fpga.h"
+#include "crossbar.h"
+#include "micro.h"
+#include "microadc.h"
+#include "model.h"
+
+/*
+ * Supercap monitor for the TS-7990
+ *
+ * DIO_6 goes high when VIN is removed.  The FPGA crossbar routes it to
+ * FPGA_IRQ_1, which is the CPU POWER_FAIL GPIO, so the edge wakes us up
+ * instead of polling.  While POWER_FAIL is high the supercap and VIN
+ * channels are sampled quickly and fed to a fit of the discharge curve, and
+ * the board is only rebooted once the predicted time left before the caps
+ * reach the cutoff voltage drops under the shutdown budget.  Short brownouts
+ * are ridden out.  Discharges can be recorded and replayed through the same
+ * predictor offline to tune the budget.  A recording is kept in memory and
+ * only written to the file once power is back or the reboot is under way.
+ *
+ * With --realtime the loop runs SCHED_FIFO with all memory locked and
+ * prefaulted, and nothing is allocated or opened after startup.
+ */
+
+#define POWER_FAIL_CHIP "209c000.gpio"
+#define POWER_FAIL_LINE 4
+#define MICRO_ADDR 0x4a
+
+/* Defaults for how often to sample on the caps, and when to give up */
+#define SAMPLE_MS 10
+#define BUDGET_MS 5000
+#define VMIN_MV 5000
+
+/* How long the shutdown broadcast may hold up the reboot */
+#define WALL_WAIT_MS 500
+
+/* Discharge samples kept in memory for --record, 5 minutes at 10 ms */
+#define RECORD_SAMPLES 30000
+
+/* Stack touched up front so the loop never takes a page fault */
+#define PREFAULT_STACK (64 * 1024)
+
+static char stdout_buf[BUFSIZ];
+static char record_buf[BUFSIZ];
+
+struct record_sample {
+	int32_t ms;
+	int32_t cap_mv;
+	int32_t vin_mv;
+};
+
+/* Filled while on the caps, the file is only written once that is over */
+static struct record_sample record_samples[RECORD_SAMPLES];
+static int record_count, record_dropped;
+
+static int budget_ms = BUDGET_MS;
+static int vmin_mv = VMIN_MV;
+static int floor_pct;
+
+static int read_rails(int i2cfd, int *cap_mv, int *vin_mv)
+{
+	/* Only read the frame up to and including the supercap channel */
+	uint8_t frame[(TS7990_SUPERCAP_CHAN + 1) * 2];
+
+	if (v0_stream_read(i2cfd, MICRO_ADDR, frame, sizeof(frame)) < 0)
+		return -1;
+
+	*cap_mv = ts7990_supercap_mv(micro_adc_raw(frame, TS7990_SUPERCAP_CHAN));
+	*vin_mv = ts7990_vin_mv(micro_adc_raw(frame, TS7990_VIN_CHAN));
+
+	return 0;
+}
+
+/* left_ms is the prediction from capfit_time_left_ms() */
+static int should_shutdown(int cap_mv, int left_ms)
+{
+	if (cap_mv <= vmin_mv)
+		return 1;
+	if (floor_pct && cap_mv * 100 / TS7990_SUPERCAP_FULL_MV <= floor_pct)
+		return 1;
+
+	return left_ms >= 0 && left_ms < budget_ms;
+}
+
+static void replay_report(int event, int shutdown_ms, int left_ms, int vmin_ms, int last_ms, int low_mv)
+{
+	printf("Event %d: ", event);
+	if (shutdown_ms < 0)
+		printf("rode through, %d ms on caps, lowest %d mV\n", last_ms, low_mv);
+	else if (vmin_ms < 0)
+		printf("shutdown at %d ms, %d ms predicted left, caps never reached %d mV (lowest %d mV at %d ms)\n",
+		       shutdown_ms, left_ms, vmin_mv, low_mv, last_ms);
+	else
+		printf("shutdown at %d ms, %d ms predicted left, %d ms actual\n", shutdown_ms, left_ms,
+		       vmin_ms - shutdown_ms);
+}
+
+/*
+ * Runs a trace written by --record through the predictor.  Each line is
+ * "ms,supercap_mv,vin_mv" with ms counted from POWER_FAIL, and a line
+ * starting with # begins the next event.
+ */
+static int do_replay(const char *path)
+{
+	int shutdown_ms = -1, left_ms = -1, vmin_ms = -1, last_ms = 0, low_mv = INT_MAX;
+	int events = 0, shutdowns = 0, samples = 0;
+	struct capfit fit;
+	char buf[128];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	capfit_init(&fit);
+	for (;;) {
+		int eof = fgets(buf, sizeof(buf), f) == NULL;
+		int ms, cap_mv, left;
+
+		if (eof || buf[0] == '#') {
+			if (samples) {
+				replay_report(++events, shutdown_ms, left_ms, vmin_ms, last_ms, low_mv);
+				shutdowns += shutdown_ms >= 0;
+			}
+			if (eof)
+				break;
+			shutdown_ms = left_ms = vmin_ms = -1;
+			last_ms = samples = 0;
+			low_mv = INT_MAX;
+			capfit_init(&fit);
+			continue;
+		}
+		if (sscanf(buf, "%d,%d", &ms, &cap_mv) != 2)
+			continue;
+
+		samples++;
+		last_ms = ms;
+		if (cap_mv < low_mv)
+			low_mv = cap_mv;
+		if (vmin_ms < 0 && cap_mv <= vmin_mv)
+			vmin_ms = ms;
+		if (shutdown_ms >= 0)
+			continue;
+
+		capfit_add(&fit, ms / 1000.0, cap_mv);
+		left = capfit_time_left_ms(&fit, ms / 1000.0, vmin_mv);
+		if (should_shutdown(cap_mv, left)) {
+			shutdown_ms = ms;
+			left_ms = left;
+		}
+	}
+	fclose(f);
+
+	printf("%d events, %d shutdowns with a %d ms budget and %d mV cutoff\n", events, shutdowns, budget_ms,
+	       vmin_mv);
+
+	return 0;
+}
+
+static int silo_enabled(void)
+{
+	char buf[4096];
+	ssize_t len;
+	char *p;
+	int fd;
+
+	fd = open("/proc/cmdline", O_RDONLY);
+	if (fd < 0)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+
+	for (p = strstr(buf, "ts-silo=1"); p; p = strstr(p + 1, "ts-silo=1")) {
+		if ((p == buf || p[-1] == ' ') && (p[9] == 0 || p[9] == ' ' || p[9] == '\n'))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Same as "FPGA_IRQ_1=DIO_6 tshwctl --set" */
+static int route_power_fail(void)
+{
+	const struct cbar_model *cbar = cbar_get_model(0x7990);
+	struct cbar_snapshot snap;
+	int i2cfd, input, mode;
+
+	i2cfd = fpga_init();
+	if (i2cfd == -1) {
+		perror("Can't open FPGA I2C bus");
+		return 1;
+	}
+
+	input = cbar_find_input(cbar, "FPGA_IRQ_1", strlen("FPGA_IRQ_1"));
+	mode = cbar_find_output(cbar, "DIO_6");
+	if (input < 0 || mode < 0) {
+		fprintf(stderr, "FPGA_IRQ_1 or DIO_6 missing from the crossbar\n");
+		return 1;
+	}
+
+	if (cbar_snapshot_read(i2cfd, cbar, &snap))
+		return 1;
+	cbar_set_mode(&snap, input, mode);
+
+	return cbar_snapshot_write(i2cfd, &snap);
+}
+
+static void record_add(int64_t sample_ns, int cap_mv, int vin_mv)
+{
+	struct record_sample *r;
+
+	if (record_count == RECORD_SAMPLES) {
+		record_dropped++;
+		return;
+	}
+	r = &record_samples[record_count];
+	r->ms = sample_ns / 1000000;
+	r->cap_mv = cap_mv;
+	r->vin_mv = vin_mv;
+	record_count++;
+}
+
+/* Writes out the discharge recorded since POWER_FAIL */
+static void record_write(FILE *record)
+{
+	int i;
+
+	if (record_count == 0)
+		return;
+
+	fprintf(record, "# POWER_FAIL\n");
+	for (i = 0; i < record_count; i++)
+		fprintf(record, "%d,%d,%d\n", record_samples[i].ms, record_samples[i].cap_mv,
+			record_samples[i].vin_mv);
+	if (record_dropped)
+		fprintf(record, "# %d samples not recorded\n", record_dropped);
+	fflush(record);
+
+	record_count = 0;
+	record_dropped = 0;
+}
+
+static int64_t ts_ns(const struct timespec *ts)
+{
+	return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/*
+ * Nanoseconds since the edge.  Line events are stamped with CLOCK_MONOTONIC
+ * since Linux 5.7 and CLOCK_REALTIME before that, use whichever makes sense.
+ */
+static int64_t since_edge(const struct timespec *edge)
+{
+	struct timespec now;
+	int64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = ts_ns(&now) - ts_ns(edge);
+	if (ns >= 0 && ns < 60 * 1000000000LL)
+		return ns;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ts_ns(&now) - ts_ns(edge);
+}
+
+static void prefault_stack(void)
+{
+	char stack[PREFAULT_STACK];
+
+	memset(stack, 0, sizeof(stack));
+	/* Keep the compiler from dropping the memset */
+	__asm__ __volatile__("" : : "r"(stack) : "memory");
+}
+
+static int realtime_setup(int prio)
+{
+	struct sched_param sp = { .sched_priority = prio };
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		perror("mlockall");
+		return 1;
+	}
+	prefault_stack();
+
+	if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0) {
+		perror("sched_setscheduler");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* The commands run at shutdown should not inherit --realtime */
+static void child_setup(void)
+{
+	struct sched_param sp = { .sched_priority = 0 };
+
+	sched_setscheduler(0, SCHED_OTHER, &sp);
+	munlockall();
+}
+
+/*
+ * Broadcasts the shutdown and starts the reboot.  The reboot runs in a child
+ * so whatever is logged after this cannot hold it up, returns its pid.
+ */
+static pid_t shutdown_now(void)
+{
+	struct timespec tick = { 0, 10 * 1000000L };
+	pid_t pid;
+	int i;
+
+	pid = fork();
+	if (pid == 0) {
+		child_setup();
+		execlp("wall", "wall",
+		       "tssilomon has detected main power has been lost! Shutting down safely to prevent filesystem damage.",
+		       NULL);
+		_exit(1);
+	}
+
+	/* Let the broadcast finish before rebooting, as the script did, but
+	 * never wait long on a stuck terminal */
+	for (i = 0; pid > 0 && i < WALL_WAIT_MS / 10; i++) {
+		if (waitpid(pid, NULL, WNOHANG) != 0)
+			break;
+		nanosleep(&tick, NULL);
+	}
+
+	pid = fork();
+	if (pid == 0)
+		child_setup();
+	if (pid <= 0) {
+		execlp("reboot", "reboot", NULL);
+		perror("reboot");
+		_exit(1);
+	}
+
+	return pid;
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] ...\n"
+		"embeddedTS TS-7990 supercap monitor\n"
+		"\n"
+		"  -b, --budget <ms>      Reboot when less than this is predicted left (default 5000)\n"
+		"  -v, --vmin <mV>        Supercap voltage the board browns out at (default 5000)\n"
+		"  -p, --pct <percent>    Also reboot when the supercaps drop to this (default off)\n"
+		"  -i, --interval <ms>    Sample period while on the supercaps (default 10)\n"
+		"  -o, --record <file>    Append each discharge to file\n"
+		"  -t, --replay <file>    Run a recorded discharge through the predictor and exit\n"
+		"  -n, --dry-run          Report but do not reboot\n"
+		"  -r, --realtime <prio>  Run SCHED_FIFO at prio with memory locked\n"
+		"  -g, --gpio <chip:line> POWER_FAIL GPIO (default 209c000.gpio:4)\n"
+		"  -f, --force            Run without ts-silo=1, for testing\n"
+		"  -h, --help             This message\n"
+		"\n"
+		"Needs ts-silo=1 on the kernel command line.\n"
+		"\n",
+		argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	struct gpiod_chip *chip;
+	struct gpiod_line *line;
+	struct gpiod_line_event ev;
+	struct timespec check = { 0, SAMPLE_MS * 1000000L };
+	struct capfit fit;
+	char *gpiochip = POWER_FAIL_CHIP;
+	char *replay = NULL;
+	FILE *record = NULL;
+	int gpioline = POWER_FAIL_LINE;
+	int rt_prio = 0;
+	int force = 0;
+	int dry_run = 0;
+	int on_caps = 0;
+	pid_t reboot_pid = -1;
+	int status;
+	int model;
+	int i2cfd;
+	int c, ret;
+
+	static struct option long_options[] = { { "budget", required_argument, 0, 'b' },
+						{ "vmin", required_argument, 0, 'v' },
+						{ "pct", required_argument, 0, 'p' },
+						{ "interval", required_argument, 0, 'i' },
+						{ "record", required_argument, 0, 'o' },
+						{ "replay", required_argument, 0, 't' },
+						{ "dry-run", no_argument, 0, 'n' },
+						{ "realtime", required_argument, 0, 'r' },
+						{ "gpio", required_argument, 0, 'g' },
+						{ "force", no_argument, 0, 'f' },
+						{ "help", no_argument, 0, 'h' },
+						{ 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "b:v:p:i:o:t:nr:g:fh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			budget_ms = atoi(optarg);
+			break;
+		case 'v':
+			vmin_mv = atoi(optarg);
+			break;
+		case 'p':
+			floor_pct = atoi(optarg);
+			break;
+		case 'i':
+			if (atoi(optarg) < 1 || atoi(optarg) > 1000) {
+				fprintf(stderr, "Interval must be 1-1000 ms\n");
+				return 1;
+			}
+			check.tv_nsec = atoi(optarg) * 1000000L;
+			break;
+		case 'o':
+			record = fopen(optarg, "a");
+			if (record == NULL) {
+				perror(optarg);
+				return 1;
+			}
+			setvbuf(record, record_buf, _IOFBF, sizeof(record_buf));
+			break;
+		case 't':
+			replay = optarg;
+			break;
+		case 'n':
+			dry_run = 1;
+			break;
+		case 'r':
+			rt_prio = atoi(optarg);
+			if (rt_prio < sched_get_priority_min(SCHED_FIFO) || rt_prio > sched_get_priority_max(SCHED_FIFO)) {
+				fprintf(stderr, "Invalid priority %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'g':
+			gpiochip = strdup(optarg);
+			if (strchr(gpiochip, ':') == NULL) {
+				fprintf(stderr, "Expected chip:line, not %s\n", optarg);
+				return 1;
+			}
+			*strchr(gpiochip, ':') = 0;
+			gpioline = atoi(gpiochip + strlen(gpiochip) + 1);
+			break;
+		case 'f':
+			force = 1;
+			break;
+		case 'h':
+			usage(argv);
+			return 0;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (replay)
+		return do_replay(replay);
+
+	model = get_model();
+	if (model != 0x7990) {
+		printf("Supercaps not supported on 0x%X\n", model);
+		return 0;
+	}
+
+	if (!force && !silo_enabled()) {
+		/* Supercaps are not present or turned off */
+		return 1;
+	}
+
+	if (route_power_fail())
+		return 1;
+
+	i2cfd = micro_init(0, MICRO_ADDR);
+	if (i2cfd < 0)
+		return 1;
+
+	chip = gpiod_chip_open_lookup(gpiochip);
+	if (!chip) {
+		perror(gpiochip);
+		return 1;
+	}
+	line = gpiod_chip_get_line(chip, gpioline);
+	if (!line || gpiod_line_request_both_edges_events(line, "tssilomon") < 0) {
+		fprintf(stderr, "Failed to get GPIO line %d on chip %s\n", gpioline, gpiochip);
+		return 1;
+	}
+
+	/* stdio would otherwise allocate its buffer on the first printf */
+	setvbuf(stdout, stdout_buf, _IOLBF, sizeof(stdout_buf));
+	if (rt_prio && realtime_setup(rt_prio))
+		return 1;
+
+	/* Power may already be gone */
+	capfit_init(&fit);
+	if (gpiod_line_get_value(line) == 1) {
+		on_caps = 1;
+		clock_gettime(CLOCK_MONOTONIC, &ev.ts);
+	}
+
+	for (;;) {
+		int64_t sample_ns, action_ns;
+		int cap_mv, vin_mv, left_ms;
+
+		/* Block until an edge, or poll the caps while running on them */
+		ret = gpiod_line_event_wait(line, on_caps ? &check : NULL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("gpiod_line_event_wait");
+			return 1;
+		}
+		if (ret == 1) {
+			if (gpiod_line_event_read(line, &ev) < 0) {
+				perror("gpiod_line_event_read");
+				return 1;
+			}
+			on_caps = ev.event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+			if (!on_caps) {
+				printf("Main power restored\n");
+				/* Written out here rather than while on the caps */
+				if (record)
+					record_write(record);
+				continue;
+			}
+			capfit_init(&fit);
+			record_count = 0;
+			record_dropped = 0;
+		}
+		if (!on_caps)
+			continue;
+
+		if (read_rails(i2cfd, &cap_mv, &vin_mv) < 0)
+			continue;
+		sample_ns = since_edge(&ev.ts);
+		if (record)
+			record_add(sample_ns, cap_mv, vin_mv);
+
+		capfit_add(&fit, sample_ns / 1e9, cap_mv);
+		left_ms = capfit_time_left_ms(&fit, sample_ns / 1e9, vmin_mv);
+		if (!should_shutdown(cap_mv, left_ms)) {
+			if (ret == 1)
+				printf("Supercaps at %d mV, sampled %lld us after POWER_FAIL\n", cap_mv,
+				       (long long)sample_ns / 1000);
+			continue;
+		}
+
+		action_ns = since_edge(&ev.ts);
+		if (!dry_run)
+			reboot_pid = shutdown_now();
+
+		/* stdout is usually a pipe that can block, so nothing is
+		 * written until the reboot is under way */
+		printf("Supercaps at %d mV, sampled %lld us, shutdown %lld us after POWER_FAIL, %d ms predicted left\n",
+		       cap_mv, (long long)sample_ns / 1000, (long long)action_ns / 1000, left_ms);
+		if (record)
+			record_write(record);
+		if (!dry_run) {
+			if (waitpid(reboot_pid, &status, 0) == reboot_pid && WIFEXITED(status) &&
+			    WEXITSTATUS(status) == 0)
+				return 0;
+			fprintf(stderr, "reboot failed\n");
+			return 1;
+		}
+
+		/* Wait for power to come back and go again */
+		printf("Dry run, not rebooting\n");
+		on_caps = 0;
+	}
+
+	return 0;
+}